@@ -1,10 +1,14 @@
 #pragma once
 
-#include <bitset>
-#include <stack>
 #include <algorithm>
+#include <utility>
+#include <vector>
 #include <glm/glm.hpp>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 #include "Types.hpp"
 
 /*
@@ -17,8 +21,8 @@ typedef ui8 State;
 namespace MarchingSquares {
 
 	/* Gets the next segment of this segment in a counterclockwise manner */
-	inline bool nextSegment(State* states, i64 x, i64 y, i64 w, bool fromPositive, i64& nx, i64& ny) {
-		switch (states[x + y * w]) {
+	inline bool nextSegment(State state, i64 x, i64 y, bool fromPositive, i64& nx, i64& ny) {
+		switch (state) {
 		// nothing can traverse this state
 		case 0: return false;
 		case 1: nx = x; ny = y - 1; return true;
@@ -40,123 +44,221 @@ namespace MarchingSquares {
 		}
 	}
 
-	struct Contour {
-		std::vector<glm::vec2> vertices;
-	};
+	// largest width and height of a block MarchingSquares can handle, so a row of states fits in one 64 bit word
+	const i64 MAX_SIZE = 63;
 
-	float dist(const glm::vec2& p, const glm::vec2& s, const glm::vec2& e) {
-		return std::abs((e.x - s.x) * (s.y - p.y) - (s.x - p.x) * (e.y - s.y)) / std::sqrt((e.x - s.x) * (e.x - s.x) + (e.y - s.y) * (e.y - s.y));
+	/* Index of the lowest set bit, v must not be 0 */
+	inline i64 LowestBit(ui64 v) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, v);
+		return index;
+#else
+		return __builtin_ctzll(v);
+#endif
 	}
 
-	/* Iterative Douglas Peucker to simplify my contour */
-	void DouglasPeucker(std::vector<glm::vec2>& simplified, const std::vector<glm::vec2>& contour, float epsilon) {
-		// it's fine to use std::vector<bool> because c++ has an
-		// space optimization for bool vectors.
-		std::vector<bool> keepVertex(contour.size(), true);
-		std::stack<std::pair<i64, i64>> indicesStack;
-		indicesStack.push({ 0, contour.size() - 1 });
+	/*
+		Marching squares state of cell (x, y). Every row has four bit planes, one per corner
+		of the cells: bit x of plane k is bit k of the state of cell x.
+	*/
+	inline State StateAt(const ui64* planes, i64 x, i64 y) {
+		const ui64* row = planes + y * 4;
+		return (State)(((row[0] >> x) & 1) | (((row[1] >> x) & 1) << 1) | (((row[2] >> x) & 1) << 2) | (((row[3] >> x) & 1) << 3));
+	}
 
-		i64 startIndex, endIndex;
+	/*
+		Every contour of a block back to back in one vertex buffer, contour i is the
+		spans[i].count vertices starting at vertices[spans[i].offset]. Clearing keeps the
+		capacity, so a Contours that is reused stops allocating once it has grown.
+	*/
+	struct Contours {
+		struct Span {
+			i64 offset;
+			i64 count;
+		};
+
+		std::vector<glm::vec2> vertices;
+		std::vector<Span> spans;
+
+		void Clear() {
+			vertices.clear();
+			spans.clear();
+		}
+
+		i64 Size() const {
+			return (i64)spans.size();
+		}
+
+		bool Empty() const {
+			return spans.empty();
+		}
+
+		const glm::vec2* Vertices(i64 i) const {
+			return vertices.data() + spans[i].offset;
+		}
+
+		i64 Count(i64 i) const {
+			return spans[i].count;
+		}
+
+		void Append(const glm::vec2* first, i64 count) {
+			spans.push_back({ (i64)vertices.size(), count });
+			vertices.insert(vertices.end(), first, first + count);
+		}
+
+		void Append(const Contours& other) {
+			for (i64 i = 0; i < other.Size(); i++) {
+				Append(other.Vertices(i), other.Count(i));
+			}
+		}
+	};
+
+	/*
+		Working memory of MarchingSquares, one per thread. Like Contours it only ever grows,
+		so after the first few blocks meshing a chunk doesn't touch the heap anymore.
+	*/
+	struct Scratch {
+		// a walked contour, keyed by the cell a column by column scan would have started it at
+		struct Walk {
+			i64 key;
+			i64 offset;
+			i64 count;
+		};
+
+		// every walked contour of the block back to back, as separate x and y arrays
+		std::vector<float> xs, ys;
+		std::vector<Walk> walks;
+
+		// douglas peucker
+		std::vector<std::pair<i64, i64>> indicesStack;
+		std::vector<float> distances;
+
+		void Reset() {
+			xs.clear();
+			ys.clear();
+			walks.clear();
+		}
+	};
+
+	/*
+		Iterative Douglas Peucker to simplify my contour, appends the simplified contour to simplified.
+		Works on squared distances: a point is further than epsilon from the line through s and e when
+		cross(e - s, p - s)^2 > epsilon^2 * |e - s|^2, so no sqrt or divide per point. The distances of a
+		range are computed in one pass the compiler can vectorize, then the first furthest point is looked up.
+	*/
+	inline void DouglasPeucker(Contours& simplified, const float* xs, const float* ys, i64 contourSize, float epsilon, Scratch& scratch) {
+		std::vector<std::pair<i64, i64>>& indicesStack = scratch.indicesStack;
+		scratch.distances.resize(contourSize);
+		float* distances = scratch.distances.data();
+		float epsilon2 = epsilon * epsilon;
+
+		i64 offset = simplified.vertices.size();
+		indicesStack.clear();
+		indicesStack.push_back({ 0, contourSize - 1 });
+
+		// ranges are split left before right, so the ranges that can't be split come out in order
+		// and each of them keeps only its start, the end of the last one is the end of the contour
 		while (!indicesStack.empty()) {
-			std::pair<i64, i64> currentIter = indicesStack.top();
-			startIndex = currentIter.first;
-			endIndex = currentIter.second;
-			indicesStack.pop();
+			i64 startIndex = indicesStack.back().first;
+			i64 endIndex = indicesStack.back().second;
+			indicesStack.pop_back();
+
+			float sx = xs[startIndex], sy = ys[startIndex];
+			float dx = xs[endIndex] - sx, dy = ys[endIndex] - sy;
 
 			float dmax = 0;
-			int index = startIndex;
-
-			for (i64 i = index + 1; i < endIndex; i++) {
-				if (keepVertex[i]) {
-					float d = dist(contour[i], contour[startIndex], contour[endIndex]);
-					if (d > dmax) {
-						index = i;
-						dmax = d;
-					}
-				}
+#pragma omp simd reduction(max:dmax)
+			for (i64 i = startIndex + 1; i < endIndex; i++) {
+				float cross = dx * (sy - ys[i]) - (sx - xs[i]) * dy;
+				distances[i] = cross * cross;
+				dmax = distances[i] > dmax ? distances[i] : dmax;
 			}
 
-			if (dmax > epsilon) {
-				indicesStack.push({ startIndex, index });
-				indicesStack.push({ index, endIndex });
+			if (dmax > epsilon2 * (dx * dx + dy * dy)) {
+				i64 index = startIndex + 1;
+				while (distances[index] != dmax) index++;
+
+				indicesStack.push_back({ index, endIndex });
+				indicesStack.push_back({ startIndex, index });
 			}
 			else {
-				for (int i = startIndex + 1; i < endIndex; i++) {
-					keepVertex[i] = false;
-				}
-			}
-		}
-
-		i64 contourSize = contour.size();
-		for (i64 i = 0; i < contourSize; i++) {
-			if (keepVertex[i]) {
-				simplified.push_back(contour[i]);
+				simplified.vertices.push_back({ sx, sy });
 			}
 		}
-	}
-
-	inline ui8 DataAt(const ui8* data, i64 xOff, i64 yOff, i64 xStart, i64 yStart, i64 xStride, i64 yStride, i64 w, i64 h) {
-		if (xOff < 0 || yOff < 0 || xOff >= xStride || yOff >= yStride) {
-			return 0;
-		}
 
-		return data[(xOff + xStart) + (yOff + yStart) * w];
+		simplified.vertices.push_back({ xs[contourSize - 1], ys[contourSize - 1] });
+		simplified.spans.push_back({ offset, (i64)simplified.vertices.size() - offset });
 	}
 
-	void MarchingSquares(i64 xStart, i64 yStart, i64 xStride, i64 yStride, i64 w, i64 h, ui8* data, std::vector<Contour>& contours) {
-		contours.clear();
+	/*
+		Trace the outlines of the solid cells of a block of at most MAX_SIZE x MAX_SIZE cells.
+		rows holds one word per row of the block, bit x of rows[y] is the cell (xStart + x, yStart + y).
+		Bits from xStride up are ignored, so rows can be read straight from a wider mask.
+		Cells around the block count as empty, so every contour is closed inside the block.
+		With DOUGLAS_PEUCKER the contours are simplified to within epsilon cells.
+		The contours replace the ones in contours, scratch is the calling thread's working memory.
+	*/
+	inline void MarchingSquares(i64 xStart, i64 yStart, i64 xStride, i64 yStride, const ui64* rows, float epsilon, Contours& contours, Scratch& scratch) {
+		contours.Clear();
+		scratch.Reset();
 		// pad zeroes around the states
-		i64 nw = xStride + 1, nh = yStride + 1;
-		State* states = new State[nw * nh];
-
-		// 000000 <Visited from positive?> <Visited from negative?> 
-		ui8* visited = new ui8[nw * nh];
-
-		std::fill(states, states + nw * nh, 0);
-		std::fill(visited, visited + nw * nh, 0);
-		
-		// map pixel values to states using LUT
-		for (i64 x = 0; x < nw; x++) {
-			for (i64 y = 0; y < nh; y++) {
-				states[x + y * nw] = 
-					(DataAt(data, x - 1, y - 1, xStart, yStart, xStride, yStride, w, h)) | 
-					(DataAt(data, x, y - 1, xStart, yStart, xStride, yStride, w, h) << 1) | 
-					(DataAt(data, x, y, xStart, yStart, xStride, yStride, w, h) << 2) | 
-					(DataAt(data, x - 1, y, xStart, yStart, xStride, yStride, w, h) << 3);
-
-				visited[x + y * nw] = false;
-			}
+		i64 nh = yStride + 1;
+		ui64 planes[(MAX_SIZE + 1) * 4];
+		ui64 mask = ((ui64)1 << xStride) - 1;
+
+		// one bit per state, visited from negative and from positive. only the saddles 5 and 10 use both.
+		ui64 visitedNegative[MAX_SIZE + 1];
+		ui64 visitedPositive[MAX_SIZE + 1];
+
+		// map pixel values to states, a whole row at a time
+		for (i64 y = 0; y < nh; y++) {
+			ui64 below = y > 0 ? rows[y - 1] & mask : 0;
+			ui64 here = y < yStride ? rows[y] & mask : 0;
+			planes[y * 4 + 0] = below << 1;
+			planes[y * 4 + 1] = below;
+			planes[y * 4 + 2] = here;
+			planes[y * 4 + 3] = here << 1;
+
+			visitedNegative[y] = 0;
+			visitedPositive[y] = 0;
 		}
 
 		// simplify states to contours
-		std::vector<Contour> complexContours;
-		for (i64 x = 0; x < nw; x++) {
-			for (i64 y = 0; y < nh; y++) {
+		std::vector<float>& xs = scratch.xs;
+		std::vector<float>& ys = scratch.ys;
+		for (i64 y = 0; y < nh; y++) {
+			const ui64* row = planes + y * 4;
+			// states other than 0 and 15 have a contour segment, jump straight to them
+			ui64 candidates = (row[0] | row[1] | row[2] | row[3]) & ~(row[0] & row[1] & row[2] & row[3]);
+
+			while (candidates) {
+				i64 x = LowestBit(candidates);
+				candidates &= candidates - 1;
+
 				// check state
-				State& state = states[x + y * nw];
-				ui8& isVisited = visited[x + y * nw];
+				State state = StateAt(planes, x, y);
 
-				
-				// if this state is 0 or 16, there is no contour segment here
 				// if this state is 5 or 10, don't start walking here :)
 				// if we already looked at this segment, don't walk here :)
-				if (state == 0 || state == 15 || state == 5 || state == 10 || isVisited) continue;
+				if (state == 5 || state == 10 || ((visitedNegative[y] | visitedPositive[y]) >> x) & 1) continue;
 
 				// we found a valid segment to walk!
 				// we always want to walk counter-clockwise using screen space coords.
 				// even though the game is inverted screen space coords, it doesn't matter
 				// because this algo should be symmetrical
-				Contour c;
+				i64 offset = xs.size();
+				i64 startKey = x * nh + y, startVertex = 0;
 
-				i64 px, py;
+				i64 px = x, py = y;
 				i64 cx = x, cy = y;
-				i64 nx, ny;
+				i64 nx = x, ny = y;
 				bool fromPositive = false;
 				while (1) {
-					State& cState = states[cx + cy * nw];
-					ui8& currentVisited = visited[cx + cy * nw];
+					State cState = StateAt(planes, cx, cy);
+					ui64 bit = (ui64)1 << cx;
 
-					bool visitedPositional = (bool)currentVisited;
+					bool visitedPositional = ((visitedNegative[cy] | visitedPositive[cy]) & bit) != 0;
 
 					// special handling of states 5 and 10
 					// we need to know where we come from 
@@ -169,7 +271,7 @@ namespace MarchingSquares {
 					}
 
 					if (cState == 5 || cState == 10) {
-						visitedPositional = fromPositive ? ((currentVisited >> 1) > 0) : ((currentVisited & 1) > 0);
+						visitedPositional = ((fromPositive ? visitedPositive[cy] : visitedNegative[cy]) & bit) != 0;
 					}
 
 					// if we have already seen this vertex, we are done!
@@ -178,18 +280,24 @@ namespace MarchingSquares {
 					// walk along the contour!
 
 					if (cState == 5 || cState == 10) {
-						visited[cx + cy * nw] |= fromPositive ? 2 : 1;
+						(fromPositive ? visitedPositive[cy] : visitedNegative[cy]) |= bit;
 					}
 					else {
 						// mark current vertex as visited
-						visited[cx + cy * nw] = true;
+						visitedNegative[cy] |= bit;
+
+						if (cx * nh + cy < startKey) {
+							startKey = cx * nh + cy;
+							startVertex = xs.size() - offset;
+						}
 					}
 
 					// find the next segment
-					nextSegment(states, cx, cy, nw, fromPositive, nx, ny);
+					nextSegment(cState, cx, cy, fromPositive, nx, ny);
 
 					// push current cell onto the list
-					c.vertices.push_back({ cx + (nx - cx) * 0.5 + xStart, cy + (ny - cy) * 0.5 + yStart});
+					xs.push_back(cx + (nx - cx) * 0.5f + xStart);
+					ys.push_back(cy + (ny - cy) * 0.5f + yStart);
 
 					px = cx;
 					py = cy;
@@ -197,26 +305,34 @@ namespace MarchingSquares {
 					cy = ny;
 				}
 
-				if (c.vertices.size() > 10) {
-					complexContours.push_back(c);
+				i64 count = xs.size() - offset;
+				if (count > 10) {
+					std::rotate(xs.begin() + offset, xs.begin() + offset + startVertex, xs.end());
+					std::rotate(ys.begin() + offset, ys.begin() + offset + startVertex, ys.end());
+					std::reverse(xs.begin() + offset, xs.end());
+					std::reverse(ys.begin() + offset, ys.end());
+					scratch.walks.push_back({ startKey, offset, count });
+				}
+				else {
+					xs.resize(offset);
+					ys.resize(offset);
 				}
 			}
 		}
 
+		// the rows are scanned bottom to top, keep the contours in column order so the output doesn't depend on the scan
+		std::sort(scratch.walks.begin(), scratch.walks.end(), [](const Scratch::Walk& a, const Scratch::Walk& b) { return a.key < b.key; });
+
 		// douglas peucker them contours!
-		for (auto contour : complexContours) {
-			std::reverse(contour.vertices.begin(), contour.vertices.end());
+		for (const Scratch::Walk& walk : scratch.walks) {
 #ifdef DOUGLAS_PEUCKER
-			Contour approximation;
-			DouglasPeucker(approximation.vertices, contour.vertices, .5);
-			contours.push_back(approximation);
+			DouglasPeucker(contours, xs.data() + walk.offset, ys.data() + walk.offset, walk.count, epsilon, scratch);
 #else
-			contours.push_back(contour);
+			contours.spans.push_back({ (i64)contours.vertices.size(), walk.count });
+			for (i64 i = walk.offset; i < walk.offset + walk.count; i++) {
+				contours.vertices.push_back({ xs[i], ys[i] });
+			}
 #endif
 		}
-
-
-		delete[] states;
-		delete[] visited;
 	}
 }
\ No newline at end of file
@@ -0,0 +1,923 @@
+#pragma once
+
+// Ported from polypartition, its license applies to this file:
+//
+//Copyright (C) 2011 by Ivan Fratric
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Types.hpp"
+#include "Marching.hpp"
+
+/*
+	Flat storage versions of the polypartition algorithms the collision stage uses, hole removal,
+	ear clipping, monotone triangulation and the Hertel-Mehlhorn convex partition.
+	They follow polypartition's algorithms step by step and give the same pieces (bar the monotone partition
+	bug Corner fixes), but polygons are spans of one vertex buffer (the same layout as the marching
+	squares contours) instead of TPPLPoly lists, vertices are linked by index instead of by pointer
+	and every temporary array lives in a Scratch the caller keeps around, so a warm Scratch never
+	touches the heap.
+*/
+
+namespace Partition {
+
+	// polygons back to back in one vertex buffer, the output of every function here is appended as spans
+	typedef MarchingSquares::Contours Polygons;
+
+	/* Working memory of the partition functions, one per thread. It only ever grows. */
+	struct Scratch {
+		struct Vertex {
+			glm::vec2 p;
+			i64 previous;
+			i64 next;
+			double angle;
+			bool isActive;
+			bool isConvex;
+			bool isEar;
+		};
+
+		// the polygons with their holes merged in, dead ones were merged into a later polygon
+		Polygons polygons;
+		std::vector<ui8> isHole;
+		std::vector<ui8> isAlive;
+
+		// ear clipping
+		std::vector<Vertex> vertices;
+
+		// monotone partition, vertices linked like the ear clipper's plus the copies every diagonal adds.
+		// the edges crossing the scan line are ids into edges sorted left to right in edgeTree
+		struct MonotoneVertex {
+			glm::vec2 p;
+			i64 previous;
+			i64 next;
+		};
+		struct ScanLineEdge {
+			glm::vec2 p1;
+			glm::vec2 p2;
+			i64 index;
+		};
+		std::vector<MonotoneVertex> monotoneVertices;
+		std::vector<i64> priority;
+		std::vector<ui8> vertexTypes;
+		std::vector<i64> helpers;
+		std::vector<i64> edgeOf;
+		std::vector<i64> nextCopy;
+		std::vector<ScanLineEdge> edges;
+		std::vector<i64> edgeTree;
+		std::vector<ui8> used;
+		Polygons monotone;
+
+		// triangulating one monotone polygon
+		std::vector<i64> chainOrder;
+		std::vector<signed char> chains;
+		std::vector<i64> stack;
+
+		// convex partition, triangles that get merged into bigger pieces. a merged piece is appended
+		// to the buffer and its span moved there, the piece it swallowed dies
+		Polygons pieces;
+		std::vector<ui8> isPieceAlive;
+	};
+
+	inline bool IsConvex(const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p3) {
+		return (p3.y - p1.y) * (p2.x - p1.x) - (p3.x - p1.x) * (p2.y - p1.y) > 0;
+	}
+
+	inline bool IsReflex(const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p3) {
+		return (p3.y - p1.y) * (p2.x - p1.x) - (p3.x - p1.x) * (p2.y - p1.y) < 0;
+	}
+
+	inline bool IsInside(const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p3, const glm::vec2& p) {
+		if (IsConvex(p1, p, p2)) return false;
+		if (IsConvex(p2, p, p3)) return false;
+		if (IsConvex(p3, p, p1)) return false;
+		return true;
+	}
+
+	inline bool InCone(const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p3, const glm::vec2& p) {
+		if (IsConvex(p1, p2, p3)) {
+			return IsConvex(p1, p2, p) && IsConvex(p2, p3, p);
+		}
+		return IsConvex(p1, p2, p) || IsConvex(p2, p3, p);
+	}
+
+	/*
+		The vertices are floats but angles are compared in double like polypartition's tppl_float,
+		float ties would pick other ears and bridges than the original.
+	*/
+	inline void Direction(const glm::vec2& from, const glm::vec2& to, double& dx, double& dy) {
+		dx = (double)to.x - from.x;
+		dy = (double)to.y - from.y;
+		double n = std::sqrt(dx * dx + dy * dy);
+		if (n != 0) {
+			dx /= n;
+			dy /= n;
+		}
+	}
+
+	inline bool SamePoint(const glm::vec2& a, const glm::vec2& b) {
+		return a.x == b.x && a.y == b.y;
+	}
+
+	/* Whether the segments p11-p12 and p21-p22 cross, segments sharing an endpoint don't */
+	inline bool Intersects(const glm::vec2& p11, const glm::vec2& p12, const glm::vec2& p21, const glm::vec2& p22) {
+		if (SamePoint(p11, p21) || SamePoint(p11, p22) || SamePoint(p12, p21) || SamePoint(p12, p22)) return false;
+
+		glm::vec2 v1ort = { p12.y - p11.y, p11.x - p12.x };
+		glm::vec2 v2ort = { p22.y - p21.y, p21.x - p22.x };
+
+		float dot21 = glm::dot(p21 - p11, v1ort);
+		float dot22 = glm::dot(p22 - p11, v1ort);
+		float dot11 = glm::dot(p11 - p21, v2ort);
+		float dot12 = glm::dot(p12 - p21, v2ort);
+
+		if (dot11 * dot12 > 0) return false;
+		if (dot21 * dot22 > 0) return false;
+		return true;
+	}
+
+	/* Twice the signed area, positive for counter-clockwise polygons */
+	inline double Area(const glm::vec2* points, i64 count) {
+		double area = 0;
+		for (i64 i1 = 0; i1 < count; i1++) {
+			i64 i2 = i1 + 1 == count ? 0 : i1 + 1;
+			area += (double)points[i1].x * points[i2].y - (double)points[i1].y * points[i2].x;
+		}
+		return area;
+	}
+
+	/*
+		Merge every clockwise contour (a hole) into the counter-clockwise contour around it through a
+		bridge to a visible vertex, like TPPLPartition::RemoveHoles. The result is scratch.polygons
+		where isAlive marks the polygons that are left. Returns false if a hole can't see its outline.
+	*/
+	inline bool RemoveHoles(const Polygons& contours, Scratch& scratch) {
+		Polygons& polys = scratch.polygons;
+		std::vector<ui8>& isHole = scratch.isHole;
+		std::vector<ui8>& isAlive = scratch.isAlive;
+		polys.Clear();
+		isHole.clear();
+		isAlive.clear();
+
+		for (i64 c = 0; c < contours.Size(); c++) {
+			polys.Append(contours.Vertices(c), contours.Count(c));
+			isHole.push_back(Area(contours.Vertices(c), contours.Count(c)) < 0);
+			isAlive.push_back(true);
+		}
+
+		while (1) {
+			// find the hole point with the largest x
+			bool hasHoles = false;
+			i64 hole = 0, holePoint = 0;
+			for (i64 h = 0; h < polys.Size(); h++) {
+				if (!isAlive[h] || !isHole[h]) continue;
+
+				if (!hasHoles) {
+					hasHoles = true;
+					hole = h;
+					holePoint = 0;
+				}
+
+				const glm::vec2* points = polys.Vertices(h);
+				for (i64 i = 0; i < polys.Count(h); i++) {
+					if (points[i].x > polys.Vertices(hole)[holePoint].x) {
+						hole = h;
+						holePoint = i;
+					}
+				}
+			}
+			if (!hasHoles) break;
+			glm::vec2 holeP = polys.Vertices(hole)[holePoint];
+
+			// find the closest visible outline vertex to the right of it
+			bool pointFound = false;
+			i64 poly = 0, polyPoint = 0;
+			glm::vec2 bestP;
+			for (i64 o = 0; o < polys.Size(); o++) {
+				if (!isAlive[o] || isHole[o]) continue;
+
+				const glm::vec2* points = polys.Vertices(o);
+				i64 count = polys.Count(o);
+				for (i64 i = 0; i < count; i++) {
+					if (points[i].x <= holeP.x) continue;
+					if (!InCone(points[(i + count - 1) % count], points[i], points[(i + 1) % count], holeP)) continue;
+
+					glm::vec2 polyP = points[i];
+					if (pointFound) {
+						double v1x, v1y, v2x, v2y;
+						Direction(holeP, polyP, v1x, v1y);
+						Direction(holeP, bestP, v2x, v2y);
+						if (v2x > v1x) continue;
+					}
+
+					bool pointVisible = true;
+					for (i64 o2 = 0; o2 < polys.Size() && pointVisible; o2++) {
+						if (!isAlive[o2] || isHole[o2]) continue;
+
+						const glm::vec2* lines = polys.Vertices(o2);
+						i64 lineCount = polys.Count(o2);
+						for (i64 i2 = 0; i2 < lineCount; i2++) {
+							if (Intersects(holeP, polyP, lines[i2], lines[(i2 + 1) % lineCount])) {
+								pointVisible = false;
+								break;
+							}
+						}
+					}
+
+					if (pointVisible) {
+						pointFound = true;
+						bestP = polyP;
+						poly = o;
+						polyPoint = i;
+					}
+				}
+			}
+
+			if (!pointFound) return false;
+
+			// outline up to the bridge, around the hole and back along the bridge, appended as a new polygon
+			i64 polyCount = polys.Count(poly), holeCount = polys.Count(hole);
+			i64 offset = polys.vertices.size();
+			for (i64 i = 0; i <= polyPoint; i++) {
+				polys.vertices.push_back(polys.Vertices(poly)[i]);
+			}
+			for (i64 i = 0; i <= holeCount; i++) {
+				polys.vertices.push_back(polys.Vertices(hole)[(i + holePoint) % holeCount]);
+			}
+			for (i64 i = polyPoint; i < polyCount; i++) {
+				polys.vertices.push_back(polys.Vertices(poly)[i]);
+			}
+			polys.spans.push_back({ offset, (i64)polys.vertices.size() - offset });
+
+			isAlive[hole] = false;
+			isAlive[poly] = false;
+			isHole.push_back(false);
+			isAlive.push_back(true);
+		}
+
+		return true;
+	}
+
+	inline void UpdateVertex(Scratch::Vertex& v, const Scratch::Vertex* vertices, i64 numVertices) {
+		const glm::vec2& p1 = vertices[v.previous].p;
+		const glm::vec2& p3 = vertices[v.next].p;
+
+		v.isConvex = IsConvex(p1, v.p, p3);
+
+		double x1, y1, x3, y3;
+		Direction(v.p, p1, x1, y1);
+		Direction(v.p, p3, x3, y3);
+		v.angle = x1 * x3 + y1 * y3;
+
+		v.isEar = v.isConvex;
+		if (!v.isConvex) return;
+
+		for (i64 i = 0; i < numVertices; i++) {
+			const glm::vec2& p = vertices[i].p;
+			if (SamePoint(p, v.p) || SamePoint(p, p1) || SamePoint(p, p3)) continue;
+			if (IsInside(p1, v.p, p3, p)) {
+				v.isEar = false;
+				break;
+			}
+		}
+	}
+
+	/* Triangulate one counter-clockwise polygon without holes by ear clipping, like TPPLPartition::Triangulate_EC */
+	inline bool Triangulate_EC(const glm::vec2* points, i64 numVertices, Polygons& triangles, Scratch& scratch) {
+		if (numVertices < 3) return false;
+		if (numVertices == 3) {
+			triangles.Append(points, 3);
+			return true;
+		}
+
+		std::vector<Scratch::Vertex>& vertexList = scratch.vertices;
+		vertexList.resize(numVertices);
+		Scratch::Vertex* vertices = vertexList.data();
+		for (i64 i = 0; i < numVertices; i++) {
+			vertices[i].isActive = true;
+			vertices[i].p = points[i];
+			vertices[i].next = i == numVertices - 1 ? 0 : i + 1;
+			vertices[i].previous = i == 0 ? numVertices - 1 : i - 1;
+		}
+		for (i64 i = 0; i < numVertices; i++) {
+			UpdateVertex(vertices[i], vertices, numVertices);
+		}
+
+		glm::vec2 triangle[3];
+		for (i64 i = 0; i < numVertices - 3; i++) {
+			// find the most extruded ear
+			i64 ear = -1;
+			for (i64 j = 0; j < numVertices; j++) {
+				if (!vertices[j].isActive || !vertices[j].isEar) continue;
+				if (ear < 0 || vertices[j].angle > vertices[ear].angle) {
+					ear = j;
+				}
+			}
+			if (ear < 0) return false;
+
+			Scratch::Vertex& v = vertices[ear];
+			triangle[0] = vertices[v.previous].p;
+			triangle[1] = v.p;
+			triangle[2] = vertices[v.next].p;
+			triangles.Append(triangle, 3);
+
+			v.isActive = false;
+			vertices[v.previous].next = v.next;
+			vertices[v.next].previous = v.previous;
+
+			if (i == numVertices - 4) break;
+
+			UpdateVertex(vertices[v.previous], vertices, numVertices);
+			UpdateVertex(vertices[v.next], vertices, numVertices);
+		}
+
+		for (i64 i = 0; i < numVertices; i++) {
+			if (vertices[i].isActive) {
+				triangle[0] = vertices[vertices[i].previous].p;
+				triangle[1] = vertices[i].p;
+				triangle[2] = vertices[vertices[i].next].p;
+				triangles.Append(triangle, 3);
+				break;
+			}
+		}
+
+		return true;
+	}
+
+	/* Whether p1 comes before p2 scanning bottom to top, points at the same height go left to right */
+	inline bool Below(const glm::vec2& p1, const glm::vec2& p2) {
+		if (p1.y < p2.y) return true;
+		return p1.y == p2.y && p1.x < p2.x;
+	}
+
+	/* Left to right order of the edges crossing the scan line, like TPPLPartition::ScanLineEdge */
+	inline bool EdgeLess(const Scratch::ScanLineEdge& a, const Scratch::ScanLineEdge& b) {
+		if (b.p1.y == b.p2.y) {
+			if (a.p1.y == a.p2.y) return a.p1.y < b.p1.y;
+			return IsConvex(a.p1, a.p2, b.p1);
+		}
+		if (a.p1.y == a.p2.y || a.p1.y < b.p1.y) {
+			return !IsConvex(b.p1, b.p2, a.p1);
+		}
+		return IsConvex(a.p1, a.p2, b.p1);
+	}
+
+	/*
+		The scan line is a sorted vector instead of a std::set, it holds only the edges a horizontal line
+		crosses, a handful in a chunk, so shifting them is cheap and a warm Scratch doesn't allocate.
+		Inserting and erasing are O(k) in those k edges instead of O(log k).
+		Like std::set::insert an edge equal to one already there isn't added, returns the id in the tree.
+	*/
+	inline i64 InsertEdge(Scratch& scratch, const glm::vec2& p1, const glm::vec2& p2, i64 index) {
+		std::vector<i64>& tree = scratch.edgeTree;
+		Scratch::ScanLineEdge edge = { p1, p2, index };
+		auto it = std::lower_bound(tree.begin(), tree.end(), edge, [&](i64 id, const Scratch::ScanLineEdge& e) { return EdgeLess(scratch.edges[id], e); });
+		if (it != tree.end() && !EdgeLess(edge, scratch.edges[*it])) return *it;
+
+		scratch.edges.push_back(edge);
+		i64 id = scratch.edges.size() - 1;
+		tree.insert(it, id);
+		return id;
+	}
+
+	inline void EraseEdge(Scratch& scratch, i64 id) {
+		std::vector<i64>& tree = scratch.edgeTree;
+		auto it = std::find(tree.begin(), tree.end(), id);
+		if (it != tree.end()) tree.erase(it);
+	}
+
+	/* The edge directly left of p, -1 if there is none */
+	inline i64 LeftEdge(Scratch& scratch, const glm::vec2& p) {
+		std::vector<i64>& tree = scratch.edgeTree;
+		Scratch::ScanLineEdge edge = { p, p, 0 };
+		auto it = std::lower_bound(tree.begin(), tree.end(), edge, [&](i64 id, const Scratch::ScanLineEdge& e) { return EdgeLess(scratch.edges[id], e); });
+		if (it == tree.begin()) return -1;
+		return *(it - 1);
+	}
+
+	namespace VertexType {
+		enum Id : ui8 { REGULAR, START, END, SPLIT, MERGE };
+	}
+
+	/*
+		The copy of vertex index whose corner the diagonal towards p leaves through. polypartition always
+		splits the copy it is given, which tears the pieces apart once a vertex has two diagonals and the
+		second one leaves through the other copy's corner.
+	*/
+	inline i64 Corner(const Scratch& scratch, i64 index, const glm::vec2& p) {
+		const Scratch::MonotoneVertex* vertices = scratch.monotoneVertices.data();
+		i64 c = index;
+		do {
+			if (InCone(vertices[vertices[c].previous].p, vertices[c].p, vertices[vertices[c].next].p, p)) return c;
+			c = scratch.nextCopy[c];
+		} while (c != index);
+		return index;
+	}
+
+	/* Split the polygon through index1 and index2 by linking copies of both vertices the other way around */
+	inline void AddDiagonal(Scratch& scratch, i64& numVertices, i64 index1, i64 index2) {
+		Scratch::MonotoneVertex* vertices = scratch.monotoneVertices.data();
+		index1 = Corner(scratch, index1, vertices[index2].p);
+		index2 = Corner(scratch, index2, vertices[index1].p);
+		i64 newIndex1 = numVertices++;
+		i64 newIndex2 = numVertices++;
+
+		vertices[newIndex1].p = vertices[index1].p;
+		vertices[newIndex2].p = vertices[index2].p;
+
+		vertices[newIndex2].next = vertices[index2].next;
+		vertices[newIndex1].next = vertices[index1].next;
+
+		vertices[vertices[index2].next].previous = newIndex2;
+		vertices[vertices[index1].next].previous = newIndex1;
+
+		vertices[index1].next = newIndex2;
+		vertices[newIndex2].previous = index1;
+
+		vertices[index2].next = newIndex1;
+		vertices[newIndex1].previous = index2;
+
+		scratch.nextCopy[newIndex1] = scratch.nextCopy[index1];
+		scratch.nextCopy[index1] = newIndex1;
+		scratch.nextCopy[newIndex2] = scratch.nextCopy[index2];
+		scratch.nextCopy[index2] = newIndex2;
+
+		// the copies take over the edges that started at the originals
+		scratch.vertexTypes[newIndex1] = scratch.vertexTypes[index1];
+		scratch.edgeOf[newIndex1] = scratch.edgeOf[index1];
+		scratch.helpers[newIndex1] = scratch.helpers[index1];
+		if (scratch.edgeOf[newIndex1] >= 0) scratch.edges[scratch.edgeOf[newIndex1]].index = newIndex1;
+
+		scratch.vertexTypes[newIndex2] = scratch.vertexTypes[index2];
+		scratch.edgeOf[newIndex2] = scratch.edgeOf[index2];
+		scratch.helpers[newIndex2] = scratch.helpers[index2];
+		if (scratch.edgeOf[newIndex2] >= 0) scratch.edges[scratch.edgeOf[newIndex2]].index = newIndex2;
+	}
+
+	/*
+		Split polygons (outlines counter-clockwise, holes clockwise) into y-monotone pieces with a sweep
+		from top to bottom, like TPPLPartition::MonotonePartition. Holes need no bridges, the sweep
+		connects them to the outline itself. O(n log n + n k) with k the edges crossing the scan line, since the
+		scan line is a sorted vector (see InsertEdge), appends the pieces to monotone.
+	*/
+	inline bool MonotonePartition(const Polygons& polys, Polygons& monotone, Scratch& scratch) {
+		i64 numVertices = 0;
+		for (i64 p = 0; p < polys.Size(); p++) {
+			if (polys.Count(p) < 3) return false;
+			numVertices += polys.Count(p);
+		}
+
+		// every diagonal adds two copies and there are fewer diagonals than vertices
+		i64 maxVertices = numVertices * 3;
+		scratch.monotoneVertices.resize(maxVertices);
+		Scratch::MonotoneVertex* vertices = scratch.monotoneVertices.data();
+		i64 newNumVertices = numVertices;
+
+		i64 polyStart = 0;
+		for (i64 p = 0; p < polys.Size(); p++) {
+			const glm::vec2* points = polys.Vertices(p);
+			i64 count = polys.Count(p);
+			i64 polyEnd = polyStart + count - 1;
+			for (i64 i = 0; i < count; i++) {
+				vertices[polyStart + i].p = points[i];
+				vertices[polyStart + i].previous = i == 0 ? polyEnd : polyStart + i - 1;
+				vertices[polyStart + i].next = i == count - 1 ? polyStart : polyStart + i + 1;
+			}
+			polyStart = polyEnd + 1;
+		}
+
+		// sweep the vertices top to bottom, at the same height right to left
+		std::vector<i64>& priority = scratch.priority;
+		priority.resize(numVertices);
+		for (i64 i = 0; i < numVertices; i++) priority[i] = i;
+		std::sort(priority.begin(), priority.end(), [&](i64 a, i64 b) {
+			return vertices[a].p.y > vertices[b].p.y || (vertices[a].p.y == vertices[b].p.y && vertices[a].p.x > vertices[b].p.x);
+		});
+
+		std::vector<ui8>& vertexTypes = scratch.vertexTypes;
+		vertexTypes.resize(maxVertices);
+		for (i64 i = 0; i < numVertices; i++) {
+			const glm::vec2& p = vertices[i].p;
+			const glm::vec2& previous = vertices[vertices[i].previous].p;
+			const glm::vec2& next = vertices[vertices[i].next].p;
+
+			if (Below(previous, p) && Below(next, p)) {
+				vertexTypes[i] = IsConvex(next, previous, p) ? VertexType::START : VertexType::SPLIT;
+			}
+			else if (Below(p, previous) && Below(p, next)) {
+				vertexTypes[i] = IsConvex(next, previous, p) ? VertexType::END : VertexType::MERGE;
+			}
+			else {
+				vertexTypes[i] = VertexType::REGULAR;
+			}
+		}
+
+		std::vector<i64>& helpers = scratch.helpers;
+		std::vector<i64>& edgeOf = scratch.edgeOf;
+		helpers.resize(maxVertices);
+		edgeOf.assign(maxVertices, -1);
+		scratch.nextCopy.resize(maxVertices);
+		for (i64 i = 0; i < numVertices; i++) scratch.nextCopy[i] = i;
+		scratch.edges.clear();
+		scratch.edgeTree.clear();
+
+		// the steps are the ones in "Computational Geometry: Algorithms and Applications" by de Berg et al.,
+		// edge e_i starts at vertex v_i, so v_i is between e_i-1 and e_i
+		bool error = false;
+		for (i64 i = 0; i < numVertices && !error; i++) {
+			i64 vIndex = priority[i];
+			i64 vIndex2 = vIndex;
+			i64 edge;
+
+			switch (vertexTypes[vIndex]) {
+			case VertexType::START:
+				// insert e_i and make v_i its helper
+				edgeOf[vIndex] = InsertEdge(scratch, vertices[vIndex].p, vertices[vertices[vIndex].next].p, vIndex);
+				helpers[vIndex] = vIndex;
+				break;
+
+			case VertexType::END: {
+				i64 previous = vertices[vIndex].previous;
+				if (edgeOf[previous] < 0) {
+					error = true;
+					break;
+				}
+				// connect v_i to the helper of e_i-1 if that is a merge vertex, then remove e_i-1
+				if (vertexTypes[helpers[previous]] == VertexType::MERGE) {
+					AddDiagonal(scratch, newNumVertices, vIndex, helpers[previous]);
+				}
+				EraseEdge(scratch, edgeOf[previous]);
+				break;
+			}
+
+			case VertexType::SPLIT:
+				// connect v_i to the helper of the edge left of it, then insert e_i
+				edge = LeftEdge(scratch, vertices[vIndex].p);
+				if (edge < 0) {
+					error = true;
+					break;
+				}
+				AddDiagonal(scratch, newNumVertices, vIndex, helpers[scratch.edges[edge].index]);
+				vIndex2 = newNumVertices - 2;
+				helpers[scratch.edges[edge].index] = vIndex;
+
+				edgeOf[vIndex2] = InsertEdge(scratch, vertices[vIndex2].p, vertices[vertices[vIndex2].next].p, vIndex2);
+				helpers[vIndex2] = vIndex2;
+				break;
+
+			case VertexType::MERGE: {
+				i64 previous = vertices[vIndex].previous;
+				if (edgeOf[previous] < 0) {
+					error = true;
+					break;
+				}
+				// the end vertex step for e_i-1, then the left edge gets v_i as its helper
+				if (vertexTypes[helpers[previous]] == VertexType::MERGE) {
+					AddDiagonal(scratch, newNumVertices, vIndex, helpers[previous]);
+					vIndex2 = newNumVertices - 2;
+				}
+				EraseEdge(scratch, edgeOf[previous]);
+
+				edge = LeftEdge(scratch, vertices[vIndex].p);
+				if (edge < 0) {
+					error = true;
+					break;
+				}
+				if (vertexTypes[helpers[scratch.edges[edge].index]] == VertexType::MERGE) {
+					AddDiagonal(scratch, newNumVertices, vIndex2, helpers[scratch.edges[edge].index]);
+				}
+				helpers[scratch.edges[edge].index] = vIndex2;
+				break;
+			}
+
+			case VertexType::REGULAR:
+				// the interior of the polygon is right of v_i
+				if (Below(vertices[vIndex].p, vertices[vertices[vIndex].previous].p)) {
+					i64 previous = vertices[vIndex].previous;
+					if (edgeOf[previous] < 0) {
+						error = true;
+						break;
+					}
+					if (vertexTypes[helpers[previous]] == VertexType::MERGE) {
+						AddDiagonal(scratch, newNumVertices, vIndex, helpers[previous]);
+						vIndex2 = newNumVertices - 2;
+					}
+					EraseEdge(scratch, edgeOf[previous]);
+
+					edgeOf[vIndex2] = InsertEdge(scratch, vertices[vIndex2].p, vertices[vertices[vIndex2].next].p, vIndex2);
+					helpers[vIndex2] = vIndex;
+				}
+				else {
+					edge = LeftEdge(scratch, vertices[vIndex].p);
+					if (edge < 0) {
+						error = true;
+						break;
+					}
+					if (vertexTypes[helpers[scratch.edges[edge].index]] == VertexType::MERGE) {
+						AddDiagonal(scratch, newNumVertices, vIndex, helpers[scratch.edges[edge].index]);
+					}
+					helpers[scratch.edges[edge].index] = vIndex;
+				}
+				break;
+			}
+		}
+		if (error) return false;
+
+		// every cycle of the linked vertices is a monotone piece
+		std::vector<ui8>& used = scratch.used;
+		used.assign(newNumVertices, false);
+		for (i64 i = 0; i < newNumVertices; i++) {
+			if (used[i]) continue;
+
+			i64 offset = monotone.vertices.size();
+			i64 v = i;
+			do {
+				monotone.vertices.push_back(vertices[v].p);
+				used[v] = true;
+				v = vertices[v].next;
+			} while (v != i);
+			monotone.spans.push_back({ offset, (i64)monotone.vertices.size() - offset });
+		}
+
+		return true;
+	}
+
+	inline void AppendTriangle(Polygons& triangles, const glm::vec2& p1, const glm::vec2& p2, const glm::vec2& p3) {
+		glm::vec2 triangle[3] = { p1, p2, p3 };
+		triangles.Append(triangle, 3);
+	}
+
+	/* Triangulate one y-monotone counter-clockwise polygon in O(n), like TPPLPartition::TriangulateMonotone */
+	inline bool TriangulateMonotone(const glm::vec2* points, i64 numPoints, Polygons& triangles, Scratch& scratch) {
+		if (numPoints < 3) return false;
+		if (numPoints == 3) {
+			triangles.Append(points, 3);
+			return true;
+		}
+
+		i64 topIndex = 0, bottomIndex = 0;
+		for (i64 i = 1; i < numPoints; i++) {
+			if (Below(points[i], points[bottomIndex])) bottomIndex = i;
+			if (Below(points[topIndex], points[i])) topIndex = i;
+		}
+
+		// check if the poly is really monotone
+		for (i64 i = topIndex; i != bottomIndex; ) {
+			i64 i2 = i + 1 == numPoints ? 0 : i + 1;
+			if (!Below(points[i2], points[i])) return false;
+			i = i2;
+		}
+		for (i64 i = bottomIndex; i != topIndex; ) {
+			i64 i2 = i + 1 == numPoints ? 0 : i + 1;
+			if (!Below(points[i], points[i2])) return false;
+			i = i2;
+		}
+
+		// merge the left (1) and right (-1) chains top to bottom
+		std::vector<i64>& order = scratch.chainOrder;
+		std::vector<signed char>& chains = scratch.chains;
+		order.resize(numPoints);
+		chains.resize(numPoints);
+
+		order[0] = topIndex;
+		chains[topIndex] = 0;
+		i64 leftIndex = topIndex + 1 == numPoints ? 0 : topIndex + 1;
+		i64 rightIndex = topIndex == 0 ? numPoints - 1 : topIndex - 1;
+		i64 i = 1;
+		for (; i < numPoints - 1; i++) {
+			if (leftIndex != bottomIndex && (rightIndex == bottomIndex || !Below(points[leftIndex], points[rightIndex]))) {
+				order[i] = leftIndex;
+				leftIndex = leftIndex + 1 == numPoints ? 0 : leftIndex + 1;
+				chains[order[i]] = 1;
+			}
+			else {
+				order[i] = rightIndex;
+				rightIndex = rightIndex == 0 ? numPoints - 1 : rightIndex - 1;
+				chains[order[i]] = -1;
+			}
+		}
+		order[i] = bottomIndex;
+		chains[bottomIndex] = 0;
+
+		std::vector<i64>& stack = scratch.stack;
+		stack.resize(numPoints);
+		stack[0] = order[0];
+		stack[1] = order[1];
+		i64 stackPtr = 2;
+
+		// cut off as many triangles as possible at every vertex from top to bottom
+		for (i = 2; i < numPoints - 1; i++) {
+			i64 vIndex = order[i];
+			if (chains[vIndex] != chains[stack[stackPtr - 1]]) {
+				// on the other chain, fan to everything on the stack
+				for (i64 j = 0; j < stackPtr - 1; j++) {
+					if (chains[vIndex] == 1) {
+						AppendTriangle(triangles, points[stack[j + 1]], points[stack[j]], points[vIndex]);
+					}
+					else {
+						AppendTriangle(triangles, points[stack[j]], points[stack[j + 1]], points[vIndex]);
+					}
+				}
+				stack[0] = order[i - 1];
+				stack[1] = order[i];
+				stackPtr = 2;
+			}
+			else {
+				// on the same chain, cut while the corner is convex
+				stackPtr--;
+				while (stackPtr > 0) {
+					const glm::vec2& p1 = points[stack[stackPtr - 1]];
+					const glm::vec2& p2 = points[stack[stackPtr]];
+					if (chains[vIndex] == 1 ? !IsConvex(points[vIndex], p1, p2) : !IsConvex(points[vIndex], p2, p1)) break;
+
+					if (chains[vIndex] == 1) {
+						AppendTriangle(triangles, points[vIndex], p1, p2);
+					}
+					else {
+						AppendTriangle(triangles, points[vIndex], p2, p1);
+					}
+					stackPtr--;
+				}
+				stackPtr++;
+				stack[stackPtr] = vIndex;
+				stackPtr++;
+			}
+		}
+
+		i64 vIndex = order[i];
+		for (i64 j = 0; j < stackPtr - 1; j++) {
+			if (chains[stack[j + 1]] == 1) {
+				AppendTriangle(triangles, points[stack[j]], points[stack[j + 1]], points[vIndex]);
+			}
+			else {
+				AppendTriangle(triangles, points[stack[j + 1]], points[stack[j]], points[vIndex]);
+			}
+		}
+
+		return true;
+	}
+
+	/* Triangulate polygons with holes through a monotone partition, like TPPLPartition::Triangulate_MONO. O(n log n + n k) like MonotonePartition */
+	inline bool Triangulate_MONO(const Polygons& polys, Polygons& triangles, Scratch& scratch) {
+		Polygons& monotone = scratch.monotone;
+		monotone.Clear();
+		if (!MonotonePartition(polys, monotone, scratch)) return false;
+
+		for (i64 p = 0; p < monotone.Size(); p++) {
+			if (!TriangulateMonotone(monotone.Vertices(p), monotone.Count(p), triangles, scratch)) return false;
+		}
+		return true;
+	}
+
+	/*
+		Hertel-Mehlhorn convex partition of one counter-clockwise polygon without holes, like
+		TPPLPartition::ConvexPartition_HM: ear clip it, then drop every diagonal whose removal keeps
+		both sides convex. Pieces never grow past maxVertices, so they fit a b2PolygonShape.
+	*/
+	inline bool ConvexPartition_HM(const glm::vec2* points, i64 numPoints, i64 maxVertices, Polygons& parts, Scratch& scratch) {
+		if (numPoints < 3) return false;
+
+		// check if the poly is already convex
+		bool hasReflex = false;
+		for (i64 i11 = 0; i11 < numPoints && !hasReflex; i11++) {
+			i64 i12 = i11 == 0 ? numPoints - 1 : i11 - 1;
+			i64 i13 = i11 == numPoints - 1 ? 0 : i11 + 1;
+			hasReflex = IsReflex(points[i12], points[i11], points[i13]);
+		}
+		if (!hasReflex && numPoints <= maxVertices) {
+			parts.Append(points, numPoints);
+			return true;
+		}
+
+		Polygons& pieces = scratch.pieces;
+		std::vector<ui8>& isAlive = scratch.isPieceAlive;
+		pieces.Clear();
+		if (!Triangulate_EC(points, numPoints, pieces, scratch)) return false;
+		isAlive.assign(pieces.Size(), true);
+
+		// pieces grow while they are merged, so only look at them through the buffer
+		std::vector<glm::vec2>& v = pieces.vertices;
+		for (i64 p1 = 0; p1 < pieces.Size(); p1++) {
+			if (!isAlive[p1]) continue;
+
+			for (i64 i11 = 0; i11 < pieces.Count(p1); i11++) {
+				i64 o1 = pieces.spans[p1].offset, c1 = pieces.Count(p1);
+				glm::vec2 d1 = v[o1 + i11];
+				i64 i12 = (i11 + 1) % c1;
+				glm::vec2 d2 = v[o1 + i12];
+
+				// find the piece on the other side of this edge
+				bool isDiagonal = false;
+				i64 p2, o2, c2, i21, i22;
+				for (p2 = p1 + 1; p2 < pieces.Size() && !isDiagonal; p2++) {
+					if (!isAlive[p2]) continue;
+					o2 = pieces.spans[p2].offset;
+					c2 = pieces.Count(p2);
+
+					for (i21 = 0; i21 < c2; i21++) {
+						if (!SamePoint(d2, v[o2 + i21])) continue;
+						i22 = (i21 + 1) % c2;
+						if (!SamePoint(d1, v[o2 + i22])) continue;
+						isDiagonal = true;
+						break;
+					}
+				}
+				if (!isDiagonal) continue;
+				p2--;
+
+				if (c1 + c2 - 2 > maxVertices) continue;
+
+				// both ends of the diagonal have to stay convex without it
+				glm::vec2 q1 = v[o1 + (i11 == 0 ? c1 - 1 : i11 - 1)];
+				glm::vec2 q3 = v[o2 + (i22 == c2 - 1 ? 0 : i22 + 1)];
+				if (!IsConvex(q1, v[o1 + i11], q3)) continue;
+
+				q3 = v[o1 + (i12 == c1 - 1 ? 0 : i12 + 1)];
+				q1 = v[o2 + (i21 == 0 ? c2 - 1 : i21 - 1)];
+				if (!IsConvex(q1, v[o1 + i12], q3)) continue;
+
+				i64 offset = v.size();
+				for (i64 j = i12; j != i11; j = (j + 1) % c1) {
+					v.push_back(v[o1 + j]);
+				}
+				for (i64 j = i22; j != i21; j = (j + 1) % c2) {
+					v.push_back(v[o2 + j]);
+				}
+				pieces.spans[p1] = { offset, (i64)v.size() - offset };
+				isAlive[p2] = false;
+
+				i11 = -1;
+			}
+		}
+
+		for (i64 p = 0; p < pieces.Size(); p++) {
+			if (isAlive[p]) {
+				parts.Append(pieces.Vertices(p), pieces.Count(p));
+			}
+		}
+
+		return true;
+	}
+
+	// blocks with more contour vertices than this are triangulated with the monotone partition instead of ear clipping
+	const i64 EAR_CLIPPING_MAX_VERTICES = 32;
+
+	/*
+		Triangulate marching squares contours (outlines counter-clockwise, holes clockwise) into triangles.
+		Ear clipping picks the best shaped ear every step but bridging the holes and clipping are quadratic
+		or worse, so past EAR_CLIPPING_MAX_VERTICES the block goes through Triangulate_MONO, which takes
+		the holes as they are. A block costs at most the ear clipping of EAR_CLIPPING_MAX_VERTICES vertices
+		or O(n log n + n k) with k the edges crossing the scan line, which stays small in a block.
+		Unlike TPPLPartition a polygon that fails doesn't stop the rest, returns false if any failed.
+	*/
+	inline bool Triangulate(const Polygons& contours, Polygons& triangles, Scratch& scratch) {
+		triangles.Clear();
+		if ((i64)contours.vertices.size() > EAR_CLIPPING_MAX_VERTICES) {
+			return Triangulate_MONO(contours, triangles, scratch);
+		}
+
+		if (!RemoveHoles(contours, scratch)) return false;
+
+		bool ok = true;
+		const Polygons& polys = scratch.polygons;
+		for (i64 p = 0; p < polys.Size(); p++) {
+			if (!scratch.isAlive[p]) continue;
+			ok &= Triangulate_EC(polys.Vertices(p), polys.Count(p), triangles, scratch);
+		}
+		return ok;
+	}
+
+	/* Like Triangulate but into convex pieces of at most maxVertices vertices */
+	inline bool ConvexPartition(const Polygons& contours, i64 maxVertices, Polygons& parts, Scratch& scratch) {
+		parts.Clear();
+		if (!RemoveHoles(contours, scratch)) return false;
+
+		bool ok = true;
+		const Polygons& polys = scratch.polygons;
+		for (i64 p = 0; p < polys.Size(); p++) {
+			if (!scratch.isAlive[p]) continue;
+			ok &= ConvexPartition_HM(polys.Vertices(p), polys.Count(p), maxVertices, parts, scratch);
+		}
+		return ok;
+	}
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Types.hpp"
+
+/*
+    Scoped stage timers for the main thread.
+
+    Wrap a stage in PROFILE_SCOPE("name") and call PROFILE_FRAME() once at the start of every frame.
+    The timings can be written out as a CSV with one row per frame and one column per stage,
+    or as a Chrome trace (load it in chrome://tracing or Perfetto).
+
+    Everything compiles away unless PROFILING is defined.
+*/
+
+namespace Profiler {
+
+    struct Event {
+        const char* name;
+        i64 frame;
+        double startUs, durationUs;
+    };
+
+    class Profiler {
+    public:
+        // stop recording after this many events, so a long session can't eat all the memory
+        static const size_t MAX_EVENTS = 1 << 22;
+
+        static Profiler& Get() {
+            static Profiler profiler;
+            return profiler;
+        }
+
+        void NextFrame() {
+            frame++;
+        }
+
+        double NowUs() const {
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+        }
+
+        void Record(const char* name, double startUs, double endUs) {
+            if (events.size() >= MAX_EVENTS) return;
+            events.push_back({ name, frame, startUs, endUs - startUs });
+        }
+
+        /* Forget every recorded event, e.g. the warmup of a benchmark */
+        void Clear() {
+            events.clear();
+            frame = 0;
+        }
+
+        /* Total milliseconds spent in a stage over every recorded frame */
+        double TotalMs(const std::string& stage) const {
+            double us = 0;
+            for (const Event& e : events) {
+                if (stage == e.name) us += e.durationUs;
+            }
+            return us / 1000.0;
+        }
+
+        /* One row per frame, one column per stage with the total milliseconds spent in it that frame */
+        bool WriteCsv(const std::string& filename) const {
+            std::ofstream out(filename);
+            if (!out) return false;
+
+            // columns in the order stages were first seen
+            std::vector<std::string> stages;
+            for (const Event& e : events) {
+                if (std::find(stages.begin(), stages.end(), e.name) == stages.end()) stages.push_back(e.name);
+            }
+
+            out << "frame";
+            for (auto& stage : stages) out << "," << stage;
+            out << "\n";
+
+            std::vector<double> row(stages.size());
+            for (size_t i = 0; i < events.size();) {
+                i64 rowFrame = events[i].frame;
+                std::fill(row.begin(), row.end(), 0.0);
+                for (; i < events.size() && events[i].frame == rowFrame; i++) {
+                    row[std::find(stages.begin(), stages.end(), events[i].name) - stages.begin()] += events[i].durationUs / 1000.0;
+                }
+
+                out << rowFrame;
+                for (double ms : row) out << "," << ms;
+                out << "\n";
+            }
+            return true;
+        }
+
+        /* Chrome trace event format, one complete event per timed scope */
+        bool WriteChromeTrace(const std::string& filename) const {
+            std::ofstream out(filename);
+            if (!out) return false;
+
+            out << "{\"traceEvents\": [";
+            for (size_t i = 0; i < events.size(); i++) {
+                const Event& e = events[i];
+                out << (i ? ",\n" : "\n") << "{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, \"ts\": "
+                    << e.startUs << ", \"dur\": " << e.durationUs << ", \"args\": {\"frame\": " << e.frame << "}}";
+            }
+            out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+            return true;
+        }
+
+    private:
+        Profiler() : origin(std::chrono::steady_clock::now()) {}
+
+        std::chrono::steady_clock::time_point origin;
+        std::vector<Event> events;
+        i64 frame = 0;
+    };
+
+    /* Records the time between its construction and destruction */
+    class ScopedTimer {
+    public:
+        ScopedTimer(const char* name) : name(name), startUs(Profiler::Get().NowUs()) {}
+
+        ~ScopedTimer() {
+            Profiler& profiler = Profiler::Get();
+            profiler.Record(name, startUs, profiler.NowUs());
+        }
+
+    private:
+        const char* name;
+        double startUs;
+    };
+}
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef PROFILING
+#define PROFILE_SCOPE(name) Profiler::ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_FRAME() Profiler::Profiler::Get().NextFrame()
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_FRAME()
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Types.hpp"
+
+/*
+    Counter based random numbers for the particle kernels.
+
+    Every draw is a pure function of (key, counter), where the key is derived from
+    (seed, tick, chunk) and the counter from the cell and draw slot. There is no shared
+    state, so any number of threads can draw at once without locking, and a chunk's worth
+    of bits can be generated up front in one tight loop.
+*/
+
+namespace Random {
+
+    // golden ratio increment used by SplitMix64
+    const ui64 GAMMA = 0x9E3779B97F4A7C15ull;
+
+    /* SplitMix64 finalizer */
+    inline ui64 Mix(ui64 z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    /* Key of the stream for one chunk on one tick */
+    inline ui64 Key(ui64 seed, ui64 tick, ui64 chunk) {
+        return Mix(Mix(Mix(seed) + tick * GAMMA) + chunk * GAMMA);
+    }
+
+    /* The counter-th 32 bit draw of the stream with this key */
+    inline ui32 Draw(ui64 key, ui64 counter) {
+        return (ui32)(Mix(key + counter * GAMMA) >> 32);
+    }
+
+    /* Bulk version of Draw, writes draws counter .. counter + n - 1 into out */
+    inline void Fill(ui32* out, ui64 key, ui64 counter, i64 n) {
+        for (i64 i = 0; i < n; i++) {
+            out[i] = Draw(key, counter + i);
+        }
+    }
+
+    /* Maps a draw to [0, 1) */
+    inline double ToUnit(ui32 r) {
+        return r * (1.0 / 4294967296.0);
+    }
+
+    /* Maps a draw to [0, n) */
+    inline ui32 ToRange(ui32 r, ui32 n) {
+        return (ui32)(((ui64)r * n) >> 32);
+    }
+}
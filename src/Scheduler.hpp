@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "Types.hpp"
+
+/*
+    A persistent pool of worker threads for flat batches of small tasks (e.g. one checkerboard phase).
+
+    Each batch is split into one contiguous range of task indices per worker. A worker pops tasks off
+    the front of its own range, and once that runs dry it steals the back half of another worker's range.
+    A range is a single 64 bit word (begin in the low half, end in the high half), so popping and stealing
+    are both one compare-and-swap and the owner and thieves never need a lock.
+
+    Workers spin for a while between batches before going to sleep, so back to back batches don't pay
+    for a thread wakeup, and Run only returns once every worker has left the batch.
+*/
+
+namespace Scheduler {
+
+    class WorkerPool {
+    public:
+        WorkerPool(i64 threads = 0) {
+            if (threads <= 0) threads = std::max<i64>(1, std::thread::hardware_concurrency());
+            ranges = std::vector<Range>(threads);
+
+            // the thread calling Run acts as worker 0
+            for (i64 w = 1; w < threads; w++) {
+                workers.emplace_back([this, w]() { WorkerLoop(w); });
+            }
+        }
+
+        ~WorkerPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                generation++;
+            }
+            wake.notify_all();
+            for (auto& worker : workers) {
+                worker.join();
+            }
+        }
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        i64 Size() const {
+            return (i64)ranges.size();
+        }
+
+        /*
+            Runs fn(task) for every task in [0, n) across the pool and waits for all of them to finish. Not reentrant.
+            fn may also take (task, worker), worker is in [0, Size()) and no two tasks run on the same worker at once,
+            so it can index per-thread state.
+        */
+        template <class F>
+        void Run(i64 n, F&& fn) {
+            if (n <= 0) return;
+
+            typedef typename std::remove_reference<F>::type Fn;
+            i64 threads = Size();
+            if (threads == 1 || n == 1) {
+                for (i64 task = 0; task < n; task++) Invoke<Fn>(&fn, task, 0);
+                return;
+            }
+
+            job = (void*)&fn;
+            invoke = &Invoke<Fn>;
+            for (i64 w = 0; w < threads; w++) {
+                ranges[w].bounds.store(Pack(n * w / threads, n * (w + 1) / threads), std::memory_order_relaxed);
+            }
+            active.store(threads, std::memory_order_relaxed);
+
+            // publish the batch
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                generation++;
+            }
+            wake.notify_all();
+
+            Work(0);
+            active.fetch_sub(1, std::memory_order_acq_rel);
+
+            // barrier: wait for every worker to leave this batch
+            while (active.load(std::memory_order_acquire) != 0) {
+                std::this_thread::yield();
+            }
+        }
+
+    private:
+        struct alignas(64) Range {
+            std::atomic<ui64> bounds{ 0 };
+        };
+
+        static const i64 SPIN_ITERATIONS = 1 << 14;
+
+        static inline ui64 Pack(ui64 begin, ui64 end) {
+            return begin | (end << 32);
+        }
+
+        template <class Fn>
+        static void Invoke(void* job, i64 task, i64 worker) {
+            if constexpr (std::is_invocable<Fn&, i64, i64>::value) (*(Fn*)job)(task, worker);
+            else (*(Fn*)job)(task);
+        }
+
+        std::vector<Range> ranges;
+        std::vector<std::thread> workers;
+
+        void* job = nullptr;
+        void (*invoke)(void*, i64, i64) = nullptr;
+        std::atomic<i64> active{ 0 };
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::atomic<ui64> generation{ 0 };
+        bool stopping = false;
+
+        /* Take the next task from the front of worker w's range */
+        bool Pop(i64 w, i64& task) {
+            std::atomic<ui64>& bounds = ranges[w].bounds;
+            ui64 r = bounds.load(std::memory_order_acquire);
+            while (true) {
+                ui64 begin = r & 0xFFFFFFFF, end = r >> 32;
+                if (begin >= end) return false;
+                if (bounds.compare_exchange_weak(r, Pack(begin + 1, end), std::memory_order_acq_rel)) {
+                    task = (i64)begin;
+                    return true;
+                }
+            }
+        }
+
+        /* Move the back half of some other worker's range into worker w's (empty) range */
+        bool Steal(i64 w) {
+            i64 threads = Size();
+            for (i64 k = 1; k < threads; k++) {
+                std::atomic<ui64>& bounds = ranges[(w + k) % threads].bounds;
+                ui64 r = bounds.load(std::memory_order_acquire);
+                while (true) {
+                    ui64 begin = r & 0xFFFFFFFF, end = r >> 32;
+                    if (begin >= end) break;
+                    ui64 mid = end - (end - begin + 1) / 2;
+                    if (bounds.compare_exchange_weak(r, Pack(begin, mid), std::memory_order_acq_rel)) {
+                        ranges[w].bounds.store(Pack(mid, end), std::memory_order_release);
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        void Work(i64 w) {
+            i64 task;
+            while (true) {
+                while (Pop(w, task)) {
+                    invoke(job, task, w);
+                }
+                if (!Steal(w)) return;
+            }
+        }
+
+        void WorkerLoop(i64 w) {
+            ui64 seen = 0;
+            while (true) {
+                // spin first, batches tend to come in quick succession
+                for (i64 i = 0; i < SPIN_ITERATIONS && generation.load(std::memory_order_acquire) == seen; i++) {
+                    std::this_thread::yield();
+                }
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [&]() { return generation.load(std::memory_order_acquire) != seen; });
+                    seen = generation.load(std::memory_order_acquire);
+                    if (stopping) return;
+                }
+
+                Work(w);
+                active.fetch_sub(1, std::memory_order_acq_rel);
+            }
+        }
+    };
+}
@@ -11,80 +11,372 @@
 #include <box2d/b2_distance_joint.h>
 #include <box2d/b2_revolute_joint.h>
 #include <box2d/b2_circle_shape.h>
+#include <glm/glm.hpp>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <string>
 #include <thread>
-#include <mutex>
+#include <utility>
+#include <vector>
 
 #include "Types.hpp"
+#include "Random.hpp"
+#include "Scheduler.hpp"
+#include "Profiler.hpp"
 #include "Marching.hpp"
+#include "Partition.hpp"
 
-#include "polypartition.h"
+// for multithreading
+#ifndef CHUNK_SIZE
+#define CHUNK_SIZE 16
+#endif
 
 namespace Simulation {
 
     // PARTICLE STUFF
+    // dense material ids, these index into the MATERIALS and types tables below
+    namespace Material {
+        // BORDER only fills the padding around the world, it can't be placed or named in reactions
+        enum Id : ui8 { AIR, SAND, WATER, OIL, WOOD, FIRE, SMOKE, GUNPOWDER, ACID, COTTON, FUSE, BORDER, COUNT };
+    };
+
+    // how a material moves, each one has its own update order
+    namespace Motion {
+        enum Id : ui8 { STATIC, POWDER, LIQUID, GAS, COUNT };
+    };
+
+    /* Everything the kernels need to know about a material, known at compile time */
+    struct MaterialInfo {
+        const char* name;
+        double dens;
+        i64 burntime;
+        bool movable;
+        bool isSolid;
+        Motion::Id motion;
+        // burns down over time, reactions with neighbours come from the ReactionTable
+        bool burns;
+    };
+
+    constexpr MaterialInfo MATERIALS[] = {
+        { "Air", 1, 0, true, false, Motion::STATIC, false },
+        { "Sand", 60, 0, true, true, Motion::POWDER, false },
+        { "Water", 5, 0, true, false, Motion::LIQUID, false },
+        { "Oil", 2, 3000, true, false, Motion::LIQUID, false },
+        { "Wood", -1, 10000, false, true, Motion::STATIC, false },
+        { "Fire", -1, 0, false, false, Motion::STATIC, true },
+        { "Smoke", .99999999, 0, true, false, Motion::GAS, false },
+        { "Gunpowder", 40, 50, true, true, Motion::POWDER, false },
+        { "Acid", 5.001, 0, true, false, Motion::LIQUID, false },
+        { "Cotton", -1, 1000, false, true, Motion::STATIC, false },
+        { "Fuse", -1, 200, false, true, Motion::STATIC, false },
+        { "Border", -1, 0, false, false, Motion::STATIC, false },
+    };
+    static_assert(sizeof(MATERIALS) / sizeof(MATERIALS[0]) == Material::COUNT, "Every material id needs an entry in MATERIALS");
+
+    struct Offset {
+        i32 x, y;
+    };
+
+    struct UpdateOrder {
+        const Offset* offsets;
+        i32 count;
+    };
+
+    constexpr Offset POWDER_UPDATE_ORDER[] = { {0, -1}, {1, -1}, {-1, -1} };
+    constexpr Offset LIQUID_UPDATE_ORDER[] = { {0, -1}, {2, -1}, {-2, -1}, {1, -1}, {-1, -1}, {2, 0}, {-2, 0}, {1, 0}, {-1, 0} };
+    constexpr Offset GAS_UPDATE_ORDER[] = { {0, 1}, {1, 1}, {-1, 1}, {1, 0}, {-1, 0} };
+    // furthest a particle reaches in one tick along either axis, liquids move 2 cells sideways
+    constexpr i32 MAX_MOVE_REACH = 2;
+    constexpr Offset REACTION_NEIGHBOURS[] = { {-1, -1}, {0, -1}, {1, -1}, {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0} };
+
+    // indexed by Motion::Id
+    constexpr UpdateOrder UPDATE_ORDERS[] = {
+        { nullptr, 0 },
+        { POWDER_UPDATE_ORDER, 3 },
+        { LIQUID_UPDATE_ORDER, 9 },
+        { GAS_UPDATE_ORDER, 5 },
+    };
+    static_assert(sizeof(UPDATE_ORDERS) / sizeof(UPDATE_ORDERS[0]) == Motion::COUNT, "Every motion needs an update order");
+
+    /*
+        Chance of a particle of material a swapping with a neighbour of material b, as a threshold on 32 random bits:
+        they swap when the draw is above it. The chance is 1 - (lighter / heavier) / 2, so particles of similar
+        density rarely trade places. The draw is compared as an integer, which gives exactly the same decisions
+        as comparing a draw in [0, 1) against (lighter / heavier) / 2.
+    */
+    struct SwapTable {
+        ui32 thresholds[Material::COUNT][Material::COUNT];
+
+        constexpr SwapTable() : thresholds() {
+            for (i64 a = 0; a < Material::COUNT; a++) {
+                for (i64 b = 0; b < Material::COUNT; b++) {
+                    double dens = MATERIALS[a].dens, density = MATERIALS[b].dens;
+                    // immovable materials never swap
+                    if (dens <= 0 || density <= 0) {
+                        thresholds[a][b] = 0xFFFFFFFF;
+                        continue;
+                    }
+
+                    double relDensity = dens / density;
+                    double chance = relDensity <= 1.0 ? relDensity / 2.0 : (1.0 / relDensity) / 2.0;
+                    thresholds[a][b] = (ui32)(chance * 4294967296.0);
+                }
+            }
+        }
+    };
+
+    constexpr SwapTable SWAP_THRESHOLDS;
+
+    /* Display information about a material, the physical properties come from MATERIALS */
     class ParticleType {
     public:
-        ParticleType(i64 id, glm::vec3 col, double dens, double flammability, i64 burntime, double acidability, bool movable, bool isSolid, std::string name) :
-            id(id), col(col), dens(dens), flammability(flammability), burntime(burntime), acidability(acidability),
-            movable(movable), isSolid(isSolid), name(name) {}
-        const i64 id;
+        ParticleType(ui8 id, glm::vec3 col) :
+            id(id), col(col), dens(MATERIALS[id].dens), burntime(MATERIALS[id].burntime),
+            movable(MATERIALS[id].movable), isSolid(MATERIALS[id].isSolid), name(MATERIALS[id].name) {}
+        const ui8 id;
         const glm::vec3 col;
         const double dens;
-        const double flammability;
         const i64 burntime;
-        const double acidability;
         const bool movable;
         const bool isSolid;
         const std::string name;
     };
 
-    const ParticleType air(0, glm::vec3{0, 0, 0}, 1, 0, 0, 0, true, false, "Air");
-    const ParticleType sand(1, glm::vec3{ .7, .5, 0.26 }, 60, 0, 0, .2, true, true, "Sand");
-    const ParticleType water(2, glm::vec3{ 0.2, 0.3, 0.8 }, 5, 0, 0, 0, true, false, "Water");
-    const ParticleType oil(3, glm::vec3{ 0.8, 0.6, 0.4 }, 2, .04, 3000, 0, true, false, "Oil");
-    const ParticleType wood(4, glm::vec3{ 0.5, 0.2, 0.1 }, -1, .001, 10000, .02, false, true, "Wood");
-    const ParticleType fire(5, glm::vec3{ 0.7, 0.1, 0.0 }, -1, 0, 0, 0, false, false, "Fire");
-    const ParticleType smoke(6, glm::vec3{ 0.1, 0.1, 0.1 }, .99999999, 0, 0, 0, true, false, "Smoke");
-    const ParticleType gunpowder(7, glm::vec3{ 0.25, 0.25, 0.25 }, 40, 1, 50, .2, true, true, "Gunpowder");
-    const ParticleType acid(8, glm::vec3{ 0.25, .9, .5 }, 5.001, 0, 0, 0, true, false, "Acid");
-    const ParticleType cotton(9, glm::vec3{ .84, .84, .84 }, -1, .05, 1000, .5, false, true, "Cotton");
-    const ParticleType fuse(10, glm::vec3{ .30, .30, .30 }, -1, .3, 200, .5, false, true, "Fuse");
-
-    const ParticleType* AIR = &air;
-    const ParticleType* SAND = &sand;
-    const ParticleType* WATER = &water;
-    const ParticleType* OIL = &oil;
-    const ParticleType* WOOD = &wood;
-    const ParticleType* FIRE = &fire;
-    const ParticleType* SMOKE = &smoke;
-    const ParticleType* GUNPOWDER = &gunpowder;
-    const ParticleType* ACID = &acid;
-    const ParticleType* COTTON = &cotton;
-    const ParticleType* FUSE = &fuse;
-
-    const ParticleType* types[] = { AIR, SAND, WATER, OIL, WOOD, FIRE, SMOKE, GUNPOWDER, ACID, COTTON, FUSE };
-
-
+    const ParticleType types[] = {
+        ParticleType(Material::AIR, glm::vec3{0, 0, 0}),
+        ParticleType(Material::SAND, glm::vec3{ .7, .5, 0.26 }),
+        ParticleType(Material::WATER, glm::vec3{ 0.2, 0.3, 0.8 }),
+        ParticleType(Material::OIL, glm::vec3{ 0.8, 0.6, 0.4 }),
+        ParticleType(Material::WOOD, glm::vec3{ 0.5, 0.2, 0.1 }),
+        ParticleType(Material::FIRE, glm::vec3{ 0.7, 0.1, 0.0 }),
+        ParticleType(Material::SMOKE, glm::vec3{ 0.1, 0.1, 0.1 }),
+        ParticleType(Material::GUNPOWDER, glm::vec3{ 0.25, 0.25, 0.25 }),
+        ParticleType(Material::ACID, glm::vec3{ 0.25, .9, .5 }),
+        ParticleType(Material::COTTON, glm::vec3{ .84, .84, .84 }),
+        ParticleType(Material::FUSE, glm::vec3{ .30, .30, .30 }),
+        ParticleType(Material::BORDER, glm::vec3{ 0, 0, 0 }),
+    };
+    static_assert(sizeof(types) / sizeof(types[0]) == Material::COUNT, "Every material id needs an entry in types");
+
+    const ParticleType* const AIR = &types[Material::AIR];
+    const ParticleType* const SAND = &types[Material::SAND];
+    const ParticleType* const WATER = &types[Material::WATER];
+    const ParticleType* const OIL = &types[Material::OIL];
+    const ParticleType* const WOOD = &types[Material::WOOD];
+    const ParticleType* const FIRE = &types[Material::FIRE];
+    const ParticleType* const SMOKE = &types[Material::SMOKE];
+    const ParticleType* const GUNPOWDER = &types[Material::GUNPOWDER];
+    const ParticleType* const ACID = &types[Material::ACID];
+    const ParticleType* const COTTON = &types[Material::COTTON];
+    const ParticleType* const FUSE = &types[Material::FUSE];
+
+    /*
+        A packed cell. t is the material id, secondary_t is the material the cell
+        physically behaves as: t itself, or the material that is burning when t is FIRE.
+        Lifetime only has to reach the largest burntime.
+        stamp is the parity of the last tick this particle was updated in, so
+        "already updated" is stamp == the current parity and needs no reset pass.
+    */
     struct Particle {
-        const ParticleType* t;
-        const ParticleType* secondary_t;
-        //glm::vec2 vel;
-        i64 lifetime;
-        bool updated;
+        ui8 t;
+        ui8 secondary_t;
+        ui16 lifetime : 15;
+        ui16 stamp : 1;
+    };
+    static_assert(sizeof(Particle) == 4, "Particle should pack into 4 bytes");
+
+    /*
+        Each cell gets Draw::COUNT random draws per tick, one slot per decision,
+        so the outcome of a decision doesn't depend on which other decisions were made.
+    */
+    namespace Draw {
+        enum Slot : ui8 { INVERT, SWAP, NEIGHBOUR, CHANCE, COUNT };
     };
 
-    void InitializeNormal(Particle & p, const ParticleType * t) {
+    inline void InitializeNormal(Particle & p, ui8 t) {
         p.t = t;
-        p.secondary_t = nullptr;
+        p.secondary_t = t;
         p.lifetime = 0;
     }
 
-    void InitializeFire(Particle & p, const ParticleType * secondary_t) {
-        InitializeNormal(p, FIRE);
+    inline void InitializeFire(Particle & p, ui8 secondary_t) {
+        InitializeNormal(p, Material::FIRE);
         p.secondary_t = secondary_t;
     }
 
+    // REACTION STUFF
+    // the rules the simulation starts with, assets/reactions.txt is an editable copy
+    const char* const DEFAULT_REACTIONS = R"(
+Fire + Oil -> Fire + Fire with probability 0.04
+Fire + Wood -> Fire + Fire with probability 0.001
+Fire + Gunpowder -> Fire + Fire with probability 1
+Fire + Cotton -> Fire + Fire with probability 0.05
+Fire + Fuse -> Fire + Fire with probability 0.3
+Fire + Air -> Fire + Smoke with probability 0.001
+Acid + Sand -> Acid + Air with probability 0.2
+Acid + Wood -> Acid + Air with probability 0.02
+Acid + Gunpowder -> Acid + Air with probability 0.2
+Acid + Cotton -> Acid + Air with probability 0.5
+Acid + Fuse -> Acid + Air with probability 0.5
+)";
+
+    /*
+        Reaction rules compiled into dense material by material tables.
+
+        A rule "A + B -> C + D with probability p" gives a cell of A that picked a neighbour
+        of B the chance p to turn into C while the neighbour turns into D. A cell turning
+        into Fire keeps burning the material it was. One line per rule, # starts a comment,
+        material names are not case sensitive and a later rule for the same pair replaces
+        the earlier one.
+    */
+    class ReactionTable {
+    public:
+        // chance out of 65536 that the pair reacts, 0 for pairs without a rule
+        ui16 thresholds[Material::COUNT][Material::COUNT];
+        ui8 selfProducts[Material::COUNT][Material::COUNT];
+        ui8 otherProducts[Material::COUNT][Material::COUNT];
+        // materials with at least one rule, only these look at their neighbours
+        bool reactive[Material::COUNT];
+
+        ReactionTable() {
+            Clear();
+        }
+
+        void Clear() {
+            for (i64 a = 0; a < Material::COUNT; a++) {
+                reactive[a] = false;
+                for (i64 b = 0; b < Material::COUNT; b++) {
+                    thresholds[a][b] = 0;
+                    selfProducts[a][b] = a;
+                    otherProducts[a][b] = b;
+                }
+            }
+        }
+
+        /* Material id of a name, or -1 if there is no such material */
+        static i64 FindMaterial(const std::string& name) {
+            for (i64 m = 0; m < Material::BORDER; m++) {
+                const char* candidate = MATERIALS[m].name;
+                if (name.size() == std::strlen(candidate) && std::equal(name.begin(), name.end(), candidate,
+                    [](char a, char b) { return std::tolower((unsigned char)a) == std::tolower((unsigned char)b); })) {
+                    return m;
+                }
+            }
+            return -1;
+        }
+
+        /*
+            Replace the table with the rules in text. On failure the table is left untouched and error says why.
+            Text without a single rule fails too, it is far more likely a wrong file than a wish for no reactions.
+        */
+        bool Parse(const std::string& text, std::string& error) {
+            ReactionTable table;
+            i64 rules = 0;
+            std::istringstream lines(text);
+            std::string line;
+            for (i64 number = 1; std::getline(lines, line); number++) {
+                line = line.substr(0, line.find('#'));
+
+                std::istringstream tokens(line);
+                std::string a, plus1, b, arrow, c, plus2, d, with, probability;
+                double p;
+                if (!(tokens >> a)) continue;
+
+                std::string extra;
+                bool valid = (tokens >> plus1 >> b >> arrow >> c >> plus2 >> d >> with >> probability >> p)
+                    && plus1 == "+" && arrow == "->" && plus2 == "+" && with == "with" && probability == "probability"
+                    && !(tokens >> extra);
+                if (!valid) {
+                    error = "line " + std::to_string(number) + ": expected \"A + B -> C + D with probability p\"";
+                    return false;
+                }
+
+                i64 ids[4] = { FindMaterial(a), FindMaterial(b), FindMaterial(c), FindMaterial(d) };
+                const std::string* names[4] = { &a, &b, &c, &d };
+                for (i64 k = 0; k < 4; k++) {
+                    if (ids[k] < 0) {
+                        error = "line " + std::to_string(number) + ": unknown material \"" + *names[k] + "\"";
+                        return false;
+                    }
+                }
+                if (!(p >= 0 && p <= 1)) {
+                    error = "line " + std::to_string(number) + ": probability has to be between 0 and 1";
+                    return false;
+                }
+
+                // a nonzero chance never rounds down to never, and certain saturates at 65535 / 65536
+                ui16 threshold = (ui16)std::min<double>(std::round(p * 65536), 65535);
+                if (p > 0 && threshold == 0) threshold = 1;
+
+                table.thresholds[ids[0]][ids[1]] = threshold;
+                table.selfProducts[ids[0]][ids[1]] = ids[2];
+                table.otherProducts[ids[0]][ids[1]] = ids[3];
+                rules++;
+            }
+
+            if (rules == 0) {
+                error = "has no reaction rules";
+                return false;
+            }
+
+            for (i64 a = 0; a < Material::COUNT; a++) {
+                for (i64 b = 0; b < Material::COUNT; b++) {
+                    table.reactive[a] |= table.thresholds[a][b] != 0;
+                }
+            }
+
+            *this = table;
+            return true;
+        }
+    };
+
+    // DIRTY RECT STUFF
+    /*
+        Inclusive bounds (in grid coordinates) of the cells that need to be ticked.
+        A rect with min > max is empty, so the chunk owning it can sleep.
+    */
+    struct DirtyRect {
+        i64 minX, minY, maxX, maxY;
+
+        DirtyRect() { Clear(); }
+        DirtyRect(i64 minX, i64 minY, i64 maxX, i64 maxY) : minX(minX), minY(minY), maxX(maxX), maxY(maxY) {}
+
+        inline void Clear() {
+            minX = minY = std::numeric_limits<i64>::max();
+            maxX = maxY = std::numeric_limits<i64>::min();
+        }
+
+        inline bool Empty() const {
+            return minX > maxX || minY > maxY;
+        }
+
+        inline void Include(i64 x0, i64 y0, i64 x1, i64 y1) {
+            minX = std::min(minX, x0);
+            minY = std::min(minY, y0);
+            maxX = std::max(maxX, x1);
+            maxY = std::max(maxY, y1);
+        }
+
+        inline void Include(const DirtyRect& o) {
+            if (!o.Empty()) Include(o.minX, o.minY, o.maxX, o.maxY);
+        }
+
+        inline bool Contains(const DirtyRect& o) const {
+            return o.Empty() || (minX <= o.minX && minY <= o.minY && maxX >= o.maxX && maxY >= o.maxY);
+        }
+
+        inline DirtyRect Intersect(const DirtyRect& o) const {
+            return DirtyRect(std::max(minX, o.minX), std::max(minY, o.minY), std::min(maxX, o.maxX), std::min(maxY, o.maxY));
+        }
+    };
+
     // RIGID STUFF
     // Only support one type of rigid body material at this time
 
@@ -93,12 +385,43 @@ namespace Simulation {
     };
     
     // GRID STUFF
+    /*
+        The particle grid. By default cells are stored row-major. With TILED_GRID every
+        CHUNK_SIZE x CHUNK_SIZE chunk is one contiguous block (chunks row-major, cells row-major
+        within a chunk), so ticking a chunk stays within a few cache lines. Either way cells are
+        addressed with operator()(x, y), and the Export/Import helpers convert to and from
+        row-major buffers for rendering and file I/O.
+
+        The world is surrounded by BORDER cells, which never move or react. Particles look at
+        most two cells away, so the kernels can read their neighbours without bounds checks.
+    */
     class Grid {
     public:
+#ifdef TILED_GRID
+        // a whole chunk, so chunks stay aligned with the tiles
+        static const i64 PADDING = CHUNK_SIZE;
+#else
+        static const i64 PADDING = 2;
+#endif
+
         ui64 width, height;
+        // number of allocated cells, including the border
+        ui64 size;
         Particle* grid;
         Grid(ui64 width, ui64 height) : width(width), height(height) {
-            grid = new Particle[width * height];
+#ifdef TILED_GRID
+            xTiles = (width + (CHUNK_SIZE - 1)) / CHUNK_SIZE + 2;
+            size = xTiles * ((height + (CHUNK_SIZE - 1)) / CHUNK_SIZE + 2) * CHUNK_SIZE * CHUNK_SIZE;
+#else
+            stride = width + 2 * PADDING;
+            size = stride * (height + 2 * PADDING);
+#endif
+            grid = new Particle[size];
+#ifdef TILED_GRID
+            origin = grid;
+#else
+            origin = grid + PADDING + PADDING * stride;
+#endif
             Reset();
         }
 
@@ -107,41 +430,96 @@ namespace Simulation {
         }
 
         void Reset() {
-            for (int i = 0; i < width * height; i++) {
-                InitializeNormal(grid[i], AIR);
+            for (ui64 i = 0; i < size; i++) {
+                InitializeNormal(grid[i], Material::BORDER);
+                grid[i].stamp = 0;
             }
+            ForEachRun([](i64 x, i64 y, i64 count, Particle* cells) {
+                for (i64 k = 0; k < count; k++) InitializeNormal(cells[k], Material::AIR);
+            });
+        }
+
+        /* Index of the cell (x, y) relative to origin, (x, y) may lie in the border */
+        inline i64 Index(i64 x, i64 y) const {
+#ifdef TILED_GRID
+            ui64 ux = x + PADDING, uy = y + PADDING;
+            return ((uy / CHUNK_SIZE) * xTiles + ux / CHUNK_SIZE) * (CHUNK_SIZE * CHUNK_SIZE) + (uy % CHUNK_SIZE) * CHUNK_SIZE + ux % CHUNK_SIZE;
+#else
+            return x + y * stride;
+#endif
         }
 
         Particle& operator()(int x, int y) {
-            return grid[x + y * width];
+            return origin[Index(x, y)];
         }
 
+        // by index, see Index
         Particle& operator()(int i) {
-            return grid[i];
+            return origin[i];
         }
 
         inline bool InBounds(i64 x, i64 y) {
             return x >= 0 && x < width&& y >= 0 && y < height;
         }
-    };
 
-    class QueryAABBCallback : public b2QueryCallback {
-    public:
-        QueryAABBCallback(bool* called) : called(called) {};
-        bool* called;
-        bool ReportFixture(b2Fixture* fixture) {
-            *called = true;
-            return true;
+        /*
+            Write convert(cell) for every cell into a row-major buffer, row y starts at out + y * rowStride
+            (a negative stride flips the rows). Cells are read in storage order.
+        */
+        template <class T, class F>
+        void Export(T* out, i64 rowStride, F&& convert) const {
+            ForEachRun([&](i64 x, i64 y, i64 count, Particle* cells) {
+                T* row = out + y * rowStride + x;
+                for (i64 k = 0; k < count; k++) row[k] = convert(cells[k]);
+            });
+        }
+
+        /* The reverse of Export, calls convert(value, cell) for every cell from a row-major buffer */
+        template <class T, class F>
+        void Import(const T* in, i64 rowStride, F&& convert) {
+            ForEachRun([&](i64 x, i64 y, i64 count, Particle* cells) {
+                const T* row = in + y * rowStride + x;
+                for (i64 k = 0; k < count; k++) convert(row[k], cells[k]);
+            });
+        }
+
+    private:
+        // the cell (0, 0) is at origin[Index(0, 0)]
+        Particle* origin;
+#ifdef TILED_GRID
+        ui64 xTiles;
+#else
+        i64 stride;
+#endif
+
+        /* Calls fn(x, y, count, cells) for every run of horizontally adjacent world cells that are also adjacent in storage */
+        template <class F>
+        void ForEachRun(F&& fn) const {
+#ifdef TILED_GRID
+            for (i64 yStart = 0; yStart < (i64)height; yStart += CHUNK_SIZE) {
+                for (i64 xStart = 0; xStart < (i64)width; xStart += CHUNK_SIZE) {
+                    i64 count = std::min<i64>(CHUNK_SIZE, width - xStart);
+                    for (i64 y = yStart; y < std::min<i64>(yStart + CHUNK_SIZE, height); y++) {
+                        fn(xStart, y, count, origin + Index(xStart, y));
+                    }
+                }
+            }
+#else
+            for (i64 y = 0; y < (i64)height; y++) {
+                fn(0, y, (i64)width, origin + Index(0, y));
+            }
+#endif
         }
     };
 
-    bool BodiesWithinAABB(const b2World& world, const b2AABB& aabb) {
-        // only do this if there is a rigid body in this chunk
-        bool called = false;
-        QueryAABBCallback callback(&called);
-        world.QueryAABB(&callback, aabb);
-        return called;
-    }
+    // how the terrain contours are turned into box2d fixtures
+    namespace CollisionMesh {
+        // CONVEX merges the triangles into convex pieces of up to b2_maxPolygonVertices vertices
+        enum Id : ui8 { CHAINS, TRIANGLES, CONVEX, COUNT };
+    };
+
+    constexpr const char* COLLISION_MESH_NAMES[] = { "chains", "triangles", "convex" };
+    static_assert(sizeof(COLLISION_MESH_NAMES) / sizeof(COLLISION_MESH_NAMES[0]) == CollisionMesh::COUNT, "Every collision mesh needs a name");
 
     class Simulation {
     public:
@@ -154,29 +532,116 @@ namespace Simulation {
         std::vector<RigidBody> rigidBodies;
         b2Vec2 gravity;
         b2World world;
-
-        std::mutex triangles_mutex;
-        TPPLPolyList triangles;
+        // turn off to only simulate the particles
+        bool simulateRigidBodies = true;
+        // how far (in cells) the simplified collision outlines may stray from the particles, with DOUGLAS_PEUCKER
+        float contourEpsilon = .5f;
+        // fixtures the terrain collides with
+        CollisionMesh::Id collisionMesh = CollisionMesh::CHAINS;
+        // only mesh the part of a chunk the bodies can reach next step instead of the whole chunk
+        bool collisionWindows = true;
+
+        /*
+            Static collision geometry of one chunk: one static body with either a chain loop per
+            marching squares contour or a polygon per piece of the partitioned contours.
+            Outlines wind counter-clockwise and holes clockwise, so the one-sided chains always
+            face the empty side and holes need no special treatment, the partitions merge holes in.
+            The geometry is kept across ticks and only rebuilt when the chunk's solid mask
+            version moves on or the bodies reach outside of the window it was built for, the body
+            only exists while the chunk is covered by a moving body.
+        */
+        struct ChunkCollider {
+            // solid mask version, epsilon and mesh the geometry was built from, -1 if it was never built
+            i64 version = -1;
+            float epsilon = 0;
+            CollisionMesh::Id mesh = CollisionMesh::CHAINS;
+            // the cells of the chunk the geometry covers, contours close along its edges like they do along the chunk's
+            DirtyRect window;
+            MarchingSquares::Contours contours;
+            // convex pieces of the contours, the body uses the chains instead if partitioning failed
+            Partition::Polygons pieces;
+            bool chains = true;
+            b2Body* body = nullptr;
+            // set by the parallel meshing pass, applied to the world in chunk order
+            bool remeshed = false;
+        };
+        static_assert(CHUNK_SIZE <= MarchingSquares::MAX_SIZE, "A chunk row of the solid mask must fit the marching squares words");
+        std::vector<ChunkCollider> colliders;
+        // meshing working memory of every worker
+        struct MeshScratch {
+            MarchingSquares::Scratch marching;
+            Partition::Scratch partition;
+        };
+        std::vector<MeshScratch> meshScratch;
+        // the chain vertices handed to box2d
+        std::vector<b2Vec2> loop;
+        // chunks a moving body is near, one bit per chunk, and the same chunks as a list in chunk order
+        std::vector<ui64> coverage;
+        std::vector<i64> coveredChunks;
+        // the cells of every covered chunk the bodies can reach next step
+        std::vector<DirtyRect> windows;
+        // the covered chunks of the last tick, the only ones that can still have a body
+        std::vector<i64> previousCovered;
+        std::vector<i64> touchedChunks;
 
 #ifdef DEBUG_DRAW
-        std::mutex contours_mutex;
-        std::vector<MarchingSquares::Contour> contours;
+        // the fixture outlines of every chunk with a body, joined in chunk order
+        MarchingSquares::Contours contours;
 #endif
 #endif
 
 
         Grid grid;
-        ui8* solidBuffer;
+        /*
+            isSolid of every cell as one bit per cell, kept up to date by the kernels whenever a cell changes.
+            Bit x % 64 of word x / 64 + y * solidWords. Chunks in the same phase can share a word, hence the atomics.
+        */
+        std::atomic<ui64>* solidMask;
+        i64 solidWords;
+        // cells whose solidity changed this tick, written like nextDirtyRects (by the chunk being ticked, may spill)
+        std::vector<DirtyRect> solidChanges;
+        // bumped every tick a cell of the chunk changes solidity, consumers compare it to tell whether their copy of a chunk is stale
+        std::vector<i64> solidVersions;
+
+        /** CHUNK SLEEPING **/
+        i64 xChunks, yChunks;
+        // cells each chunk scans this tick
+        std::vector<DirtyRect> dirtyRects;
+        // cells each chunk touched this tick (plus a MAX_MOVE_REACH margin), may spill into neighbouring chunks.
+        // only the thread ticking a chunk writes to that chunk's entry, so no locking is needed.
+        std::vector<DirtyRect> nextDirtyRects;
+
+        // parity of the current tick, compared against Particle::stamp
+        ui8 parity = 0;
+
+        /** REACTIONS **/
+        // starts out as DEFAULT_REACTIONS, replace it with reactions.Parse before ticking
+        ReactionTable reactions;
+
+        /** RANDOMNESS **/
+        ui64 seed;
+        // number of ticks simulated so far, keys the random streams
+        ui64 ticks = 0;
+
+        /** THREADING **/
+        Scheduler::WorkerPool pool;
+        // order of the checkerboard phases, chunks within one phase never touch
+        const glm::ivec2 PHASES[4] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+        const char* PHASE_NAMES[4] = { "tick.phase0", "tick.phase1", "tick.phase2", "tick.phase3" };
+        // awake chunks of the phase being ticked
+        std::vector<i64> activeChunks;
 
         /** UI STATE **/
         bool tabPressed;
         bool paused;
         float radius;
 
-        Simulation(std::string name, ui64 width, ui64 height) :
+        Simulation(std::string name, ui64 width, ui64 height, ui64 seed = 0, i64 threads = 0) :
             name(name), width(width), height(height),
             currentParticleType(SAND),
             grid(width, height),
+            seed(seed),
+            pool(threads),
             paused(true),
             radius(5.0),
             tabPressed(false)
@@ -286,162 +751,359 @@ namespace Simulation {
 #endif
 #endif
 
-            // allocate solid buffer
-            solidBuffer = new ui8[width * height];
+            std::string error;
+            reactions.Parse(DEFAULT_REACTIONS, error);
+
+            // allocate solid mask, the grid starts out as air
+            solidWords = (i64)((width + 63) / 64);
+            solidMask = new std::atomic<ui64>[solidWords * height];
+            for (i64 i = 0; i < solidWords * (i64)height; i++) {
+                solidMask[i].store(0, std::memory_order_relaxed);
+            }
+
+            // every chunk starts awake so the initial state gets a full look
+            xChunks = (i64)((width + (CHUNK_SIZE - 1)) / CHUNK_SIZE);
+            yChunks = (i64)((height + (CHUNK_SIZE - 1)) / CHUNK_SIZE);
+            dirtyRects.resize(xChunks * yChunks);
+            nextDirtyRects.resize(xChunks * yChunks);
+            solidChanges.resize(xChunks * yChunks);
+            solidVersions.resize(xChunks * yChunks, 0);
+            for (i64 j = 0; j < yChunks; j++) {
+                for (i64 i = 0; i < xChunks; i++) {
+                    nextDirtyRects[i + j * xChunks] = ChunkBounds(i, j);
+                }
+            }
+
+#ifdef SIMULATE_RIGID_BODIES
+            colliders.resize(xChunks * yChunks);
+            meshScratch.resize(pool.Size());
+            coverage.resize((xChunks * yChunks + 63) / 64, 0);
+            windows.resize(xChunks * yChunks);
+#endif
         }
 
         ~Simulation() {
-            delete[] solidBuffer;
+            delete[] solidMask;
+        }
+
+        inline DirtyRect ChunkBounds(i64 i, i64 j) {
+            i64 xStart = i * CHUNK_SIZE;
+            i64 yStart = j * CHUNK_SIZE;
+            i64 xEnd = std::min<i64>(xStart + CHUNK_SIZE, width);
+            i64 yEnd = std::min<i64>(yStart + CHUNK_SIZE, height);
+            return DirtyRect(xStart, yStart, xEnd - 1, yEnd - 1);
+        }
+
+        /*
+            Record that the cell (cx, cy) changed (or may change) while ticking the particle at (x, y).
+            The rect belongs to the chunk of (x, y), which is the chunk currently being ticked.
+            The margin wakes every particle that could move into the changed cell next tick.
+            Particles woken this way only move from the next tick on, unlike in a full scan.
+        */
+        inline void MarkDirty(i64 x, i64 y, i64 cx, i64 cy) {
+            DirtyRect& rect = nextDirtyRects[(x / CHUNK_SIZE) + (y / CHUNK_SIZE) * xChunks];
+            rect.Include(cx - MAX_MOVE_REACH, cy - MAX_MOVE_REACH, cx + MAX_MOVE_REACH, cy + MAX_MOVE_REACH);
+        }
+
+        /*
+            Refresh the solid mask of the cell (cx, cy) after its material changed while ticking the particle at (x, y).
+            Only the chunk of (x, y) records the change, so chunks in the same phase never write the same entry.
+        */
+        inline void UpdateSolid(i64 x, i64 y, i64 cx, i64 cy) {
+            ui64 solid = MATERIALS[grid(cx, cy).secondary_t].isSolid;
+            std::atomic<ui64>& word = solidMask[cx / 64 + cy * solidWords];
+            ui64 bit = (ui64)1 << (cx % 64);
+            if (((word.load(std::memory_order_relaxed) & bit) != 0) == solid) return;
+            word.fetch_xor(bit, std::memory_order_relaxed);
+            solidChanges[(x / CHUNK_SIZE) + (y / CHUNK_SIZE) * xChunks].Include(cx, cy, cx, cy);
+        }
+
+        /* count bits of the solid mask starting at (x, y), count must be at most 64 and stay within the row */
+        inline ui64 SolidRow(i64 x, i64 y, i64 count) const {
+            const std::atomic<ui64>* row = solidMask + y * solidWords;
+            i64 word = x / 64, shift = x % 64;
+            ui64 bits = row[word].load(std::memory_order_relaxed) >> shift;
+            if (shift > 0 && shift + count > 64) {
+                bits |= row[word + 1].load(std::memory_order_relaxed) << (64 - shift);
+            }
+            return count < 64 ? bits & (((ui64)1 << count) - 1) : bits;
+        }
+
+        /* Recompute the whole solid mask from the grid */
+        void RebuildSolidMask() {
+            for (i64 y = 0; y < (i64)height; y++) {
+                for (i64 w = 0; w < solidWords; w++) {
+                    ui64 bits = 0;
+                    for (i64 x = w * 64; x < std::min<i64>(w * 64 + 64, width); x++) {
+                        bits |= (ui64)MATERIALS[grid(x, y).secondary_t].isSolid << (x % 64);
+                    }
+                    solidMask[w + y * solidWords].store(bits, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /* Wake up the cell at (x, y) after it was edited from outside of Tick (e.g. the brush). */
+        inline void WakeCell(i64 x, i64 y) {
+            MarkDirty(x, y, x, y);
+            UpdateSolid(x, y, x, y);
         }
 
-        std::vector<glm::ivec2> SAND_UPDATE_ORDER = { {0, -1}, {1, -1}, {-1, -1} };
-        std::vector<glm::ivec2> WATER_UPDATE_ORDER = { {0, -1}, {2, -1}, {-2, -1}, {1, -1}, {-1, -1}, {2, 0}, {-2, 0}, {1, 0}, {-1, 0} };
-        std::vector<glm::ivec2> SMOKE_UPDATE_ORDER = { {0, 1}, {1, 1}, {-1, 1}, {1, 0}, {-1, 0} };
-        std::vector<glm::ivec2> FIRE_UPDATE_NEIGHBOURS = { {-1, -1}, {0, -1}, {1, -1}, {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0} };
+        /* Bump the solid version of every chunk this tick's solid changes touched */
+        void ResolveSolidChanges() {
+            for (i64 j = 0; j < yChunks; j++) {
+                for (i64 i = 0; i < xChunks; i++) {
+                    DirtyRect bounds = ChunkBounds(i, j);
+                    ui8 changed = 0;
+                    for (i64 nj = std::max<i64>(j - 1, 0); nj <= std::min<i64>(j + 1, yChunks - 1); nj++) {
+                        for (i64 ni = std::max<i64>(i - 1, 0); ni <= std::min<i64>(i + 1, xChunks - 1); ni++) {
+                            changed |= !solidChanges[ni + nj * xChunks].Intersect(bounds).Empty();
+                        }
+                    }
+                    solidVersions[i + j * xChunks] += changed;
+                }
+            }
 
+            for (auto& rect : solidChanges) {
+                rect.Clear();
+            }
+        }
+
+        /*
+            Build this tick's scan rects from last tick's changes, clipped to each chunk.
+
+            Every cell scanned last tick carries last tick's stamp, but cells that were
+            asleep may carry a stale stamp that happens to equal the current parity.
+            Whenever a chunk's rect grows past last tick's rect we restamp the new rect,
+            which only costs work proportional to the cells waking up.
+        */
+        void PrepareDirtyRects() {
+            for (i64 j = 0; j < yChunks; j++) {
+                for (i64 i = 0; i < xChunks; i++) {
+                    DirtyRect bounds = ChunkBounds(i, j);
+                    DirtyRect& rect = dirtyRects[i + j * xChunks];
+                    DirtyRect previous = rect;
+                    rect.Clear();
+
+                    // changes can spill at most one chunk over
+                    for (i64 nj = std::max<i64>(j - 1, 0); nj <= std::min<i64>(j + 1, yChunks - 1); nj++) {
+                        for (i64 ni = std::max<i64>(i - 1, 0); ni <= std::min<i64>(i + 1, xChunks - 1); ni++) {
+                            rect.Include(nextDirtyRects[ni + nj * xChunks].Intersect(bounds));
+                        }
+                    }
+
+                    if (!previous.Contains(rect)) {
+                        for (i64 y = rect.minY; y <= rect.maxY; y++) {
+                            for (i64 x = rect.minX; x <= rect.maxX; x++) {
+                                grid(x, y).stamp = parity ^ 1;
+                            }
+                        }
+                    }
+                }
+            }
+
+            for (auto& rect : nextDirtyRects) {
+                rect.Clear();
+            }
+        }
+
+        // a cell moves and weighs like its secondary material, which is the burning material for fire
         inline double getDensity(Particle& p) {
-            return p.t == FIRE ? p.secondary_t->dens : p.t->dens;
+            return MATERIALS[p.secondary_t].dens;
         }
 
         inline bool getMovable(Particle& p) {
-            return p.t == FIRE ? p.secondary_t->movable : p.t->movable;
+            return MATERIALS[p.secondary_t].movable;
         }
 
-        void UpdateNormalParticle(const ParticleType* t, i64 x, i64 y, std::vector<glm::ivec2>& updateOrder) {
+        /* Move the particle at (x, y), which behaves like material m, following the update order of motion M */
+        template <Motion::Id M>
+        void UpdateNormalParticle(ui8 m, i64 x, i64 y, const ui32* draws) {
+            constexpr UpdateOrder updateOrder = UPDATE_ORDERS[M];
+            const MaterialInfo& t = MATERIALS[m];
+
             // apply gravity 
             Particle& p = grid(x, y);
-            bool preferDown = t->dens > AIR->dens;
+            bool preferDown = t.dens > MATERIALS[Material::AIR].dens;
 
             Particle* swap = nullptr;
+            i64 swapX = 0, swapY = 0;
             double density = preferDown ? INFINITY : 0.0;
 
             // pick which air pocket to swap with
-            if (!swap) {
-                bool inverted = noise() > 0.5;
-                for (auto off : updateOrder) {
-                    i64 sx = x + (inverted ? -off.x : off.x);
-                    i64 sy = y + off.y;
-
-                    if (grid.InBounds(sx, sy)) {
-                        Particle& candidate = grid(sx, sy);
-                        if (!getMovable(candidate) || (t->isSolid && candidate.t->isSolid)) continue;
-                        // find most preferred direction
-                        double candidateDensity = getDensity(candidate);
-                        // solids cannot swap
-                        if ((preferDown && candidateDensity < density) || (!preferDown && candidateDensity > density)) {
-                            density = candidateDensity;
-                            swap = &candidate;
-                        }
-                    }
+            bool inverted = draws[Draw::INVERT] >> 31;
+            for (i32 k = 0; k < updateOrder.count; k++) {
+                const Offset& off = updateOrder.offsets[k];
+                i64 sx = x + (inverted ? -off.x : off.x);
+                i64 sy = y + off.y;
+
+                // no bounds check, the border around the world is never movable
+                Particle& candidate = grid(sx, sy);
+                // solids cannot swap
+                if (!getMovable(candidate) || (t.isSolid && MATERIALS[candidate.t].isSolid)) continue;
+                // find most preferred direction
+                double candidateDensity = getDensity(candidate);
+                if ((preferDown && candidateDensity < density) || (!preferDown && candidateDensity > density)) {
+                    density = candidateDensity;
+                    swap = &candidate;
+                    swapX = sx;
+                    swapY = sy;
                 }
             }
 
             bool doSwap = false;
             if (swap) {
-                double relDensity = t->dens / density;
+                // this particle could still move, so keep it awake even if the swap fails
+                MarkDirty(x, y, x, y);
 
-                double n = noise();
-
-                if (relDensity <= 1.0) {
-                    doSwap = n > (relDensity / 2.0);
-                }
-                else {
-                    double invDensity = 1.0 / relDensity;
-                    doSwap = n > (invDensity / 2.0);
-                }
+                doSwap = draws[Draw::SWAP] > SWAP_THRESHOLDS.thresholds[m][swap->secondary_t];
             }
 
             if (doSwap) {
                 Particle tmp = *swap;
                 *swap = p;
                 p = tmp;
-                p.updated = true;
+                p.stamp = parity;
+                MarkDirty(x, y, swapX, swapY);
+                UpdateSolid(x, y, x, y);
+                UpdateSolid(x, y, swapX, swapY);
             }
         }
 
-        void UpdateAcid(i64 x, i64 y) {
+        /* Turn the cell c into material m, returns whether it changed. Cells catching fire keep burning what they were. */
+        inline bool Transform(Particle& c, ui8 m) {
+            if (c.t == m) return false;
+            if (m == Material::FIRE) {
+                InitializeFire(c, c.secondary_t);
+            }
+            else {
+                InitializeNormal(c, m);
+            }
+            return true;
+        }
+
+        /*
+            Let the cell at (x, y) react with one random neighbour, following the reaction table.
+            Returns whether the cell itself turned into another material.
+        */
+        bool UpdateReactions(i64 x, i64 y, const ui32* draws) {
+            // reactive cells keep probing their neighbours, so they never sleep
+            MarkDirty(x, y, x, y);
+
+            // choose neighbour
+            const Offset& offset = REACTION_NEIGHBOURS[Random::ToRange(draws[Draw::NEIGHBOUR], 8)];
+            i64 px = x + offset.x, py = y + offset.y;
+
+            // the neighbour may be in the border, which has no reactions
             Particle& p = grid(x, y);
-            int choice = (int)(noise() * FIRE_UPDATE_NEIGHBOURS.size());
-            glm::ivec2& offset = FIRE_UPDATE_NEIGHBOURS[choice];
-
-            int px = x + offset.x, py = y + offset.y;
-            if (grid.InBounds(px, py)) {
-                Particle& n = grid(px, py);
-                // has n.flammibility chance to turn into fire
-                if (noise() < n.t->acidability) {
-                    // spread
-                    n.updated = true;
-                    InitializeNormal(n, AIR);
-                }
+            Particle& n = grid(px, py);
+            if ((draws[Draw::CHANCE] >> 16) >= reactions.thresholds[p.t][n.t]) return false;
+
+            ui8 self = reactions.selfProducts[p.t][n.t];
+            if (Transform(n, reactions.otherProducts[p.t][n.t])) {
+                // don't let the neighbour react this tick
+                n.stamp = parity;
+                MarkDirty(x, y, px, py);
+                UpdateSolid(x, y, px, py);
             }
+            if (!Transform(p, self)) return false;
+            UpdateSolid(x, y, x, y);
+            return true;
         }
 
         void UpdateFire(i64 x, i64 y) {
             Particle& p = grid(x, y);
             p.lifetime++;
+            // fire burns down every tick, so it never sleeps
+            MarkDirty(x, y, x, y);
 
-            // choise neighbour
-            float n = noise();
-            int choice = (int)(n * FIRE_UPDATE_NEIGHBOURS.size());
-            glm::ivec2& offset = FIRE_UPDATE_NEIGHBOURS[choice];
-
-            int px = x + offset.x, py = y + offset.y;
-            if (grid.InBounds(px, py)) {
-                Particle& n = grid(px, py);
-                // has n.flammibility chance to turn into fire
-                if (noise() < n.t->flammability) {
-                    // spread
-                    InitializeFire(n, n.t);
-                    // don't let the neighbour spread this tick
-                    n.updated = true;
-                }
-                else if (n.t == AIR && noise() < 0.001) {
-                    InitializeNormal(n, SMOKE);
-                }
+            if (p.lifetime > MATERIALS[p.secondary_t].burntime) {
+                InitializeNormal(p, Material::AIR);
+                UpdateSolid(x, y, x, y);
             }
+        }
+
+        typedef void (Simulation::*Kernel)(i64 x, i64 y, const ui32* draws);
 
-            if (p.lifetime > p.secondary_t->burntime) {
-                InitializeNormal(p, AIR);
-                //p.updated = false;
+        /* Physics of material M, the update order and densities are resolved at compile time */
+        template <ui8 M>
+        void MoveMaterial(i64 x, i64 y, const ui32* draws) {
+            constexpr Motion::Id motion = MATERIALS[M].motion;
+            if constexpr (motion != Motion::STATIC) {
+                UpdateNormalParticle<motion>(M, x, y, draws);
             }
         }
 
-        inline void TickParticle(i64 x, i64 y) {
-            Particle& p = grid(x, y);
-            if (p.updated) return;
-            p.updated = true;
+        /* Everything a cell of material M does in one tick */
+        template <ui8 M>
+        void TickMaterial(i64 x, i64 y, const ui32* draws) {
+            // a cell that reacted into another material moves as that material next tick
+            if (reactions.reactive[M] && UpdateReactions(x, y, draws)) return;
 
-            const ParticleType* t = p.t;
-            // spread fire
-            if (t == FIRE) {
-                t = p.secondary_t;
+            if constexpr (MATERIALS[M].burns) {
+                // fire moves like whatever is burning, look it up before it can burn out
+                ui8 burning = grid(x, y).secondary_t;
                 UpdateFire(x, y);
+                (this->*MOVE_KERNELS[burning])(x, y, draws);
             }
-            else if (t == ACID) {
-                UpdateAcid(x, y);
+            else {
+                MoveMaterial<M>(x, y, draws);
             }
+        }
 
-            // so physics
-            if (t == SAND || t == GUNPOWDER) {
-                UpdateNormalParticle(t, x, y, SAND_UPDATE_ORDER);
-            }
-            else if (t == WATER || t == OIL || t == ACID) {
-                UpdateNormalParticle(t, x, y, WATER_UPDATE_ORDER);
-            }
-            else if (t == SMOKE) {
-                UpdateNormalParticle(t, x, y, SMOKE_UPDATE_ORDER);
+        template <size_t... M>
+        static constexpr std::array<Kernel, sizeof...(M)> MakeMoveKernels(std::index_sequence<M...>) {
+            return { { &Simulation::MoveMaterial<M>... } };
+        }
+
+        template <size_t... M>
+        static constexpr std::array<Kernel, sizeof...(M)> MakeTickKernels(std::index_sequence<M...>) {
+            return { { &Simulation::TickMaterial<M>... } };
+        }
+
+        // one kernel per material id, so dispatch is a single indexed call instead of a compare chain (defined below the class)
+        static const std::array<Kernel, Material::COUNT> MOVE_KERNELS;
+        static const std::array<Kernel, Material::COUNT> TICK_KERNELS;
+
+        inline void TickParticle(i64 x, i64 y, const ui32* draws) {
+            Particle& p = grid(x, y);
+            if (p.stamp == parity) return;
+            p.stamp = parity;
+
+            (this->*TICK_KERNELS[p.t])(x, y, draws);
+        }
+
+        /* Index of the first random draw of cell (x, y) in its chunk's draw buffer */
+        inline i64 DrawIndex(i64 x, i64 y) {
+            return ((y % CHUNK_SIZE) * CHUNK_SIZE + (x % CHUNK_SIZE)) * Draw::COUNT;
+        }
+
+        /* Tick the cells of rect in one scan direction, the direction is fixed at compile time */
+        template <bool reverseX, bool reverseY>
+        void ScanRect(const DirtyRect& rect, const ui32* draws) {
+            for (i64 k = 0, rows = rect.maxY - rect.minY + 1; k < rows; k++) {
+                i64 y = reverseY ? rect.maxY - k : rect.minY + k;
+                for (i64 l = 0, columns = rect.maxX - rect.minX + 1; l < columns; l++) {
+                    i64 x = reverseX ? rect.maxX - l : rect.minX + l;
+                    TickParticle(x, y, draws + DrawIndex(x, y));
+                }
             }
         }
 
         void TickChunk(i64 i, i64 j, ui8 dir) {
-            i64 xStart = i * CHUNK_SIZE;
-            i64 yStart = j * CHUNK_SIZE;
-            i64 xEnd = std::min<i64>(xStart + CHUNK_SIZE, width);
-            i64 yEnd = std::min<i64>(yStart + CHUNK_SIZE, height);
-            i64 xStride = xEnd - xStart;
-            i64 yStride = yEnd - yStart;
+            // sleeping chunk, nothing changed around here last tick
+            const DirtyRect& rect = dirtyRects[i + j * xChunks];
+            if (rect.Empty()) return;
+
+            // generate this tick's random bits for the awake cells in one go.
+            // draws are indexed by the cell's position in the chunk, so they don't depend on scan order.
+            ui32 draws[CHUNK_SIZE * CHUNK_SIZE * Draw::COUNT];
+            ui64 key = Random::Key(seed, ticks, i + j * xChunks);
+            for (i64 y = rect.minY; y <= rect.maxY; y++) {
+                i64 rowStart = DrawIndex(rect.minX, y);
+                Random::Fill(draws + rowStart, key, rowStart, (rect.maxX - rect.minX + 1) * Draw::COUNT);
+            }
 
-            // tick here
+            // tick here, only the part of the chunk that is awake
             /*
                 So why are we altering the update direction every tick?
                 Because we don't want to bias the update in a particular direction, since the
@@ -450,182 +1112,347 @@ namespace Simulation {
                 For example, if we were to set dir = 0 on every tick, water will move
                 more readily leftwards, and falling sand will move more readily rightwards.
             */
-            if (dir == 0) {
-                for (i64 y = yStart; y < yEnd; y++) {
-                    for (i64 x = xStart; x < xEnd; x++) {
-                        TickParticle(x, y);
-                    }
-                }
+            switch (dir) {
+            case 0: ScanRect<false, false>(rect, draws); break;
+            case 1: ScanRect<true, false>(rect, draws); break;
+            case 2: ScanRect<true, true>(rect, draws); break;
+            default: ScanRect<false, true>(rect, draws); break;
             }
-            else if (dir == 1) {
-                for (i64 y = yStart; y < yEnd; y++) {
-                    for (i64 x = xEnd - 1; x >= xStart; x--) {
-                        TickParticle(x, y);
+        }
+
+        /*
+            Hash of the simulated state of every cell, used to check that runs are bit exact
+            (e.g. across thread counts). Stamps are left out since they are bookkeeping.
+        */
+        ui64 Checksum() {
+            std::vector<ui64> rowHashes(height);
+            // one task per row of chunks, the row hashes are combined in order afterwards
+            pool.Run(yChunks, [&](i64 j) {
+                i64 yEnd = std::min<i64>((j + 1) * CHUNK_SIZE, height);
+                for (i64 y = j * CHUNK_SIZE; y < yEnd; y++) {
+                    ui64 h = Random::Mix(y);
+                    for (i64 x = 0; x < (i64)width; x++) {
+                        Particle& p = grid(x, y);
+                        h = Random::Mix(h ^ (p.t | (p.secondary_t << 8) | ((ui64)p.lifetime << 16)));
                     }
+                    rowHashes[y] = h;
                 }
+            });
+
+            ui64 h = Random::Mix(width * Random::GAMMA + height);
+            for (ui64 rowHash : rowHashes) {
+                h = Random::Mix(h ^ rowHash);
             }
-            else if (dir == 2) {
-                for (i64 y = yEnd - 1; y >= yStart; y--) {
-                    for (i64 x = xEnd - 1; x >= xStart; x--) {
-                        TickParticle(x, y);
-                    }
+            return h;
+        }
+
+        /*
+            Load the contents of a .b file, one material id per cell with the top row first.
+            data must hold width * height bytes. Fire is loaded as burning oil.
+        */
+        void Load(const std::vector<char>& data) {
+            // start at the bottom row and walk up the file
+            grid.Import(data.data() + (height - 1) * width, -(i64)width, [](char id, Particle& p) {
+                if (id == Material::FIRE) {
+                    InitializeFire(p, Material::OIL);
                 }
-            }
-            else {
-                for (i64 y = yEnd - 1; y >= yStart; y--) {
-                    for (i64 x = xStart; x < xEnd; x++) {
-                        TickParticle(x, y);
-                    }
+                else {
+                    InitializeNormal(p, id);
+                }
+            });
+
+            RebuildSolidMask();
+
+            for (i64 j = 0; j < yChunks; j++) {
+                for (i64 i = 0; i < xChunks; i++) {
+                    nextDirtyRects[i + j * xChunks].Include(ChunkBounds(i, j));
+                    solidChanges[i + j * xChunks].Include(ChunkBounds(i, j));
                 }
             }
         }
 
         void Tick(i64 tick) {
-            for (i64 i = 0; i < width * height; i++) {
-                grid(i).updated = false;
-            }
+            PROFILE_SCOPE("tick");
 
-            // find number of chunks
-            i64 xChunks = (i64)((width + (CHUNK_SIZE - 1)) / CHUNK_SIZE);
-            i64 yChunks = (i64)((height + (CHUNK_SIZE - 1)) / CHUNK_SIZE);
+            // flip the parity, everything stamped last tick now reads as not updated
+            parity ^= 1;
+            ticks++;
 
-            ui8 dir = tick % 4;
-            // round one of four
-#pragma omp parallel for
-            for (int i = 0; i < xChunks; i += 2) {
-#pragma omp parallel for
-                for (int j = 0; j < yChunks; j += 2) {
-                    TickChunk(i, j, dir);
-                }
+            // figure out which chunks are awake
+            {
+                PROFILE_SCOPE("tick.prepare");
+                PrepareDirtyRects();
             }
 
-#pragma omp parallel for
-            for (int i = 1; i < xChunks; i += 2) {
-#pragma omp parallel for
-                for (int j = 0; j < yChunks; j += 2) {
-                    TickChunk(i, j, dir);
-                }
-            }
+            /*
+                The result of a tick only depends on the seed and the grid, never on the thread count.
+                Chunks ticked in the same phase are a chunk apart, and no particle reads or writes
+                more than two cells past its chunk, so they can't see each other's changes.
+                Random draws are keyed by cell instead of drawn in scan order, and dirty rects
+                are only written by their own chunk. So chunk order within a phase doesn't matter.
+            */
 
-#pragma omp parallel for
-            for (int i = 1; i < xChunks; i += 2) {
-#pragma omp parallel for
-                for (int j = 1; j < yChunks; j += 2) {
-                    TickChunk(i, j, dir);
+            ui8 dir = tick % 4;
+            // four rounds, one per checkerboard phase. each round is one flat batch of awake chunks.
+            for (int p = 0; p < 4; p++) {
+                PROFILE_SCOPE(PHASE_NAMES[p]);
+                const glm::ivec2& phase = PHASES[p];
+                activeChunks.clear();
+                for (i64 j = phase.y; j < yChunks; j += 2) {
+                    for (i64 i = phase.x; i < xChunks; i += 2) {
+                        if (!dirtyRects[i + j * xChunks].Empty()) {
+                            activeChunks.push_back(i + j * xChunks);
+                        }
+                    }
                 }
-            }
 
-#pragma omp parallel for
-            for (int i = 0; i < xChunks; i += 2) {
-#pragma omp parallel for
-                for (int j = 1; j < yChunks; j += 2) {
-                    TickChunk(i, j, dir);
-                }
+                pool.Run(activeChunks.size(), [&](i64 k) {
+                    i64 chunk = activeChunks[k];
+                    TickChunk(chunk % xChunks, chunk / xChunks, dir);
+                });
             }
 
-            // flush the data into the solid buffer
-            for (i64 y = 0; y < height; y++) {
-                for (i64 x = 0; x < width; x++) {
-                    Particle& p = grid(x, y);
-                    solidBuffer[y * width + x] = p.t == FIRE ? p.secondary_t->isSolid : p.t->isSolid;
-                    //solidBuffer[y * width + x] = p.t != AIR;
-                }
+            // the kernels already wrote the solid buffer, only flag the chunks they changed
+            {
+                PROFILE_SCOPE("tick.solid_changes");
+                ResolveSolidChanges();
             }
 
-            // reset triangles and contours
-            triangles.clear();
-#ifdef DEBUG_DRAW
-            contours.clear();
+#ifdef SIMULATE_RIGID_BODIES
+            if (simulateRigidBodies) {
+                TickRigidBodies();
+            }
 #endif
-
+        }
 
 #ifdef SIMULATE_RIGID_BODIES
-#pragma omp parallel for collapse(2) schedule(dynamic)
-            for (int i = 0; i < xChunks; i++) {
-                for (int j = 0; j < yChunks; j++) {
-
+        inline bool Covered(i64 chunk) const {
+            return (coverage[chunk / 64] >> (chunk % 64)) & 1;
+        }
 
-                    i64 xStart = i * CHUNK_SIZE;
-                    i64 yStart = j * CHUNK_SIZE;
-                    i64 xEnd = std::min<i64>(xStart + CHUNK_SIZE, width);
-                    i64 yEnd = std::min<i64>(yStart + CHUNK_SIZE, height);
-                    i64 xStride = xEnd - xStart;
-                    i64 yStride = yEnd - yStart;
+        // windows grow to whole tiles of this many cells, so a body has to move a bit before its window changes
+        static const i64 WINDOW_TILE = 4;
+        // cells of slack around a body, for the half cell the contours sit off the cells and the rotation of a step
+        static constexpr float WINDOW_MARGIN = 1.0f;
+        static constexpr float RIGID_TIMESTEP = (float)(1.0 / 60);
+
+        /*
+            Mark the chunks the box overlaps, touching counts like it does for b2TestOverlap, and merge the
+            cells it touches into their windows. A window never crosses a chunk border, so the contours are
+            cut along the same lines whichever windows the neighbouring chunks have.
+        */
+        void CoverAABB(const b2Vec2& lower, const b2Vec2& upper) {
+            if (upper.x < 0 || upper.y < 0 || lower.x > width || lower.y > height) return;
+
+            i64 x0 = std::max<i64>((i64)std::floor(lower.x), 0);
+            i64 y0 = std::max<i64>((i64)std::floor(lower.y), 0);
+            i64 x1 = (i64)std::floor(upper.x);
+            i64 y1 = (i64)std::floor(upper.y);
+            DirtyRect cells(x0 - x0 % WINDOW_TILE, y0 - y0 % WINDOW_TILE, x1 - x1 % WINDOW_TILE + WINDOW_TILE - 1, y1 - y1 % WINDOW_TILE + WINDOW_TILE - 1);
+
+            // a chunk spans [i * CHUNK_SIZE, (i + 1) * CHUNK_SIZE], so a box starting on a chunk border touches the chunk before it
+            i64 iStart = std::max<i64>((i64)std::ceil(lower.x / CHUNK_SIZE) - 1, 0);
+            i64 jStart = std::max<i64>((i64)std::ceil(lower.y / CHUNK_SIZE) - 1, 0);
+            i64 iEnd = std::min<i64>((i64)std::floor(upper.x / CHUNK_SIZE), xChunks - 1);
+            i64 jEnd = std::min<i64>((i64)std::floor(upper.y / CHUNK_SIZE), yChunks - 1);
+            for (i64 j = jStart; j <= jEnd; j++) {
+                for (i64 i = iStart; i <= iEnd; i++) {
+                    DirtyRect window = collisionWindows ? ChunkBounds(i, j).Intersect(cells) : ChunkBounds(i, j);
+                    if (window.Empty()) continue;
+
+                    i64 chunk = i + j * xChunks;
+                    if (Covered(chunk)) {
+                        windows[chunk].Include(window);
+                        continue;
+                    }
+                    coverage[chunk / 64] |= (ui64)1 << (chunk % 64);
+                    coveredChunks.push_back(chunk);
+                    windows[chunk] = window;
+                }
+            }
+        }
 
-                    b2AABB aabb = b2AABB{ b2Vec2((float)xStart, (float)yStart), b2Vec2((float)xEnd, (float)yEnd) };
+        /*
+            Find the chunks near a moving body in one pass over the bodies instead of a broadphase query
+            per chunk, so it costs as much as there are bodies rather than as the world is big, and the
+            meshing pass doesn't touch box2d. A fixture covers its AABB, which box2d already sweeps over
+            the last step, swept on by the body's velocity over the next step and grown by WINDOW_MARGIN.
+        */
+        void CoverBodies() {
+            std::swap(previousCovered, coveredChunks);
+            for (i64 chunk : previousCovered) {
+                coverage[chunk / 64] &= ~((ui64)1 << (chunk % 64));
+            }
+            coveredChunks.clear();
+
+            b2Vec2 margin(WINDOW_MARGIN, WINDOW_MARGIN);
+            for (b2Body* body = world.GetBodyList(); body; body = body->GetNext()) {
+                // the terrain is static, only moving bodies need it
+                if (body->GetType() == b2_staticBody || !body->IsEnabled()) continue;
+
+                b2Vec2 step = RIGID_TIMESTEP * body->GetLinearVelocity();
+                for (b2Fixture* fixture = body->GetFixtureList(); fixture; fixture = fixture->GetNext()) {
+                    for (i32 child = 0; child < fixture->GetShape()->GetChildCount(); child++) {
+                        const b2AABB& aabb = fixture->GetAABB(child);
+                        b2Vec2 lower = b2Min(aabb.lowerBound, aabb.lowerBound + step) - margin;
+                        b2Vec2 upper = b2Max(aabb.upperBound, aabb.upperBound + step) + margin;
+                        CoverAABB(lower, upper);
+                    }
+                }
+            }
+            std::sort(coveredChunks.begin(), coveredChunks.end());
+        }
 
-                    if (!BodiesWithinAABB(world, aabb)) continue;
+        /*
+            Whether b2PolygonShape::Set takes the piece as it is: convex, with at least three points that don't
+            weld together and more than b2_linearSlop squared of area. Contours simplified with a large epsilon
+            can cross each other, and then the partitions return slivers and pieces that aren't convex.
+        */
+        static bool FitsPolygonShape(const glm::vec2* vertices, i64 count) {
+            if (count < 3 || count > b2_maxPolygonVertices) return false;
+            if (Partition::Area(vertices, count) * 0.5 <= (double)b2_linearSlop * b2_linearSlop) return false;
+
+            // box2d welds points closer than half b2_linearSlop
+            float weld = 0.5f * b2_linearSlop;
+            i64 unique = 0;
+            for (i64 i = 0; i < count; i++) {
+                if (Partition::IsReflex(vertices[i], vertices[(i + 1) % count], vertices[(i + 2) % count])) return false;
+
+                bool welded = false;
+                for (i64 j = 0; j < i && !welded; j++) {
+                    glm::vec2 d = vertices[i] - vertices[j];
+                    welded = d.x * d.x + d.y * d.y < weld * weld;
+                }
+                unique += !welded;
+            }
+            return unique >= 3;
+        }
 
-                    // do marching squares
-                    std::vector<MarchingSquares::Contour> chunkContours;
-                    TPPLPolyList chunkTriangles;
-                    TPPLPartition partition;
-                    TPPLPolyList polyList;
+        /* Couple the particles to box2d and step the rigid body world */
+        void TickRigidBodies() {
+            {
+                PROFILE_SCOPE("rigid.coverage");
+                CoverBodies();
+            }
 
-                    MarchingSquares::MarchingSquares(xStart, yStart, xStride, yStride, width, height, solidBuffer, chunkContours);
+            // particles to contours, only for covered chunks whose solid mask changed or whose window grew
+            {
+                PROFILE_SCOPE("rigid.marching_squares");
+                pool.Run(coveredChunks.size(), [&](i64 task, i64 worker) {
+                    i64 chunk = coveredChunks[task];
+                    ChunkCollider& collider = colliders[chunk];
+                    const DirtyRect& window = windows[chunk];
+
+                    // geometry built for a bigger window is still right, so a body moving away doesn't rebuild it
+                    collider.remeshed = collider.version != solidVersions[chunk] || collider.epsilon != contourEpsilon || collider.mesh != collisionMesh || !collider.window.Contains(window);
+                    if (!collider.remeshed) return;
+
+                    collider.version = solidVersions[chunk];
+                    collider.epsilon = contourEpsilon;
+                    collider.mesh = collisionMesh;
+                    collider.window = window;
+
+                    i64 xStart = window.minX;
+                    i64 yStart = window.minY;
+                    i64 xStride = window.maxX - window.minX + 1;
+                    i64 yStride = window.maxY - window.minY + 1;
+                    ui64 rows[CHUNK_SIZE];
+                    for (i64 y = 0; y < yStride; y++) {
+                        rows[y] = SolidRow(xStart, yStart + y, xStride);
+                    }
+                    MarchingSquares::MarchingSquares(xStart, yStart, xStride, yStride, rows, contourEpsilon, collider.contours, meshScratch[worker].marching);
+
+                    collider.pieces.Clear();
+                    Partition::Scratch& partition = meshScratch[worker].partition;
+                    switch (collisionMesh) {
+                    case CollisionMesh::TRIANGLES:
+                        collider.chains = !Partition::Triangulate(collider.contours, collider.pieces, partition);
+                        break;
+                    case CollisionMesh::CONVEX:
+                        collider.chains = !Partition::ConvexPartition(collider.contours, b2_maxPolygonVertices, collider.pieces, partition);
+                        break;
+                    default:
+                        collider.chains = true;
+                        break;
+                    }
 
+                    // one piece box2d would reject or replace makes the whole chunk use its chains
+                    for (i64 p = 0; p < collider.pieces.Size() && !collider.chains; p++) {
+                        collider.chains = !FitsPolygonShape(collider.pieces.Vertices(p), collider.pieces.Count(p));
+                    }
+                });
+            }
 
-                    // convert contours to polygons using polypartition
-                    for (auto contour : chunkContours) {
-                        TPPLPoly poly;
-                        i64 numPoints = contour.vertices.size();
-                        poly.Init(numPoints);
-                        for (int i = 0; i < numPoints; i++) {
-                            TPPLPoint& p = poly.GetPoint(i);
-                            p.x = contour.vertices[i].x;
-                            p.y = contour.vertices[i].y;
-                        }
+            // add these constraints to the world! in chunk order, so box2d sees the same bodies regardless of thread count
+            {
+                PROFILE_SCOPE("rigid.update_static");
+                b2BodyDef posDef;
+                posDef.position.Set(0, 0);
+
+                // a chunk that wasn't covered last tick has no body, so only the chunks covered then or now change
+                touchedChunks.clear();
+                std::set_union(previousCovered.begin(), previousCovered.end(), coveredChunks.begin(), coveredChunks.end(), std::back_inserter(touchedChunks));
+                for (i64 chunk : touchedChunks) {
+                    ChunkCollider& collider = colliders[chunk];
+                    bool needed = Covered(chunk);
+
+                    // stale or no longer needed
+                    if (collider.body && (collider.remeshed || !needed)) {
+                        world.DestroyBody(collider.body);
+                        collider.body = nullptr;
+                    }
 
-                        if (poly.GetOrientation() == TPPL_CW) {
-                            poly.SetHole(true);
+                    if (!needed || collider.body || collider.contours.Empty()) continue;
+
+                    collider.body = world.CreateBody(&posDef);
+                    if (!collider.chains) {
+                        b2Vec2 polygon[b2_maxPolygonVertices];
+                        for (i64 p = 0; p < collider.pieces.Size(); p++) {
+                            const glm::vec2* vertices = collider.pieces.Vertices(p);
+                            i64 count = collider.pieces.Count(p);
+                            for (i64 v = 0; v < count; v++) {
+                                polygon[v] = { vertices[v].x, vertices[v].y };
+                            }
+
+                            b2PolygonShape shape;
+                            shape.Set(polygon, (i32)count);
+                            collider.body->CreateFixture(&shape, 0);
                         }
-
-                        polyList.push_back(poly);
+                        continue;
                     }
 
-                    TPPLPolyList tmpPolys;
-                    partition.RemoveHoles(&polyList, &tmpPolys);
-                    partition.Triangulate_EC(&tmpPolys, &chunkTriangles);
+                    for (i64 c = 0; c < collider.contours.Size(); c++) {
+                        // a loop needs at least three corners
+                        i64 count = collider.contours.Count(c);
+                        if (count < 3) continue;
 
-                    // flush triangles to global list
-                    {
-                        const std::lock_guard<std::mutex> lock(triangles_mutex);
-                        triangles.insert(triangles.end(), chunkTriangles.begin(), chunkTriangles.end());
-                    }
+                        const glm::vec2* vertices = collider.contours.Vertices(c);
+                        loop.clear();
+                        for (i64 v = 0; v < count; v++) {
+                            loop.push_back({ vertices[v].x, vertices[v].y });
+                        }
 
-#ifdef DEBUG_DRAW
-                    {
-                        const std::lock_guard<std::mutex> lock(contours_mutex);
-                        contours.insert(contours.end(), chunkContours.begin(), chunkContours.end());
+                        b2ChainShape chain;
+                        chain.CreateLoop(loop.data(), (i32)loop.size());
+                        collider.body->CreateFixture(&chain, 0);
                     }
-#endif
                 }
-            }
-
-            std::vector<b2Body*> staticBodies;
 
-            // add these constraints to the world!
-            b2BodyDef posDef;
-            posDef.position.Set(0, 0);
-
-            b2Vec2 triBuffer[3];
-            for (auto triangle : triangles) {
-                triBuffer[0] = { (float)triangle.GetPoint(0).x, (float)triangle.GetPoint(0).y };
-                triBuffer[1] = { (float)triangle.GetPoint(1).x, (float)triangle.GetPoint(1).y };
-                triBuffer[2] = { (float)triangle.GetPoint(2).x, (float)triangle.GetPoint(2).y };
-
-                b2Body* groundBody = world.CreateBody(&posDef);
-                b2PolygonShape triangleShape;
-                triangleShape.Set(triBuffer, 3);
-                groundBody->CreateFixture(&triangleShape, 0);
-
-                staticBodies.push_back(groundBody);
+#ifdef DEBUG_DRAW
+                contours.Clear();
+                for (i64 chunk : coveredChunks) {
+                    const ChunkCollider& collider = colliders[chunk];
+                    contours.Append(collider.chains ? collider.contours : collider.pieces);
+                }
+#endif
             }
 
             // simulate rigid bodies
-            float timestep = 1.0 / 60;
-            i32 velIters = 6, posIters = 2;
-            world.Step(timestep, velIters, posIters);
+            {
+                PROFILE_SCOPE("rigid.step");
+                i32 velIters = 6, posIters = 2;
+                world.Step(RIGID_TIMESTEP, velIters, posIters);
+            }
 
             for (auto rbody : rigidBodies) {
                 b2Body* body = rbody.body;
@@ -636,20 +1463,10 @@ namespace Simulation {
                 // what is this filthy printf statement doing here!
                 // printf("%4.2f %4.2f %4.2f\n", pos.x, pos.y, angle);
             }
-
-            for (auto staticBody : staticBodies) {
-                world.DestroyBody(staticBody);
-            }
-#endif
-            
         }
+#endif
     };
-};
 
-namespace Rendering {
-    struct Particle {
-        GLuint id;
-        // how much of the lifetime of this particle is over?
-        GLfloat lifetime_ratio;
-    };
-};
\ No newline at end of file
+    inline const std::array<Simulation::Kernel, Material::COUNT> Simulation::MOVE_KERNELS = Simulation::MakeMoveKernels(std::make_index_sequence<Material::COUNT>());
+    inline const std::array<Simulation::Kernel, Material::COUNT> Simulation::TICK_KERNELS = Simulation::MakeTickKernels(std::make_index_sequence<Material::COUNT>());
+};
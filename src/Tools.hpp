@@ -0,0 +1,66 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Types.hpp"
+#include "Simulation.hpp"
+
+/*
+    Helpers shared by the command line tools (headless, benchmark, collision_benchmark).
+*/
+
+namespace Tools {
+
+    /* The whole file as bytes, empty if it can't be read */
+    inline std::vector<char> ReadFile(const std::string& filename) {
+        std::ifstream file(filename, std::ios::binary);
+        std::ostringstream ss;
+        ss << file.rdbuf();
+        const std::string& s = ss.str();
+        return std::vector<char>(s.begin(), s.end());
+    }
+
+    /* Split a comma separated option value, empty parts are dropped */
+    inline std::vector<std::string> Split(const std::string& s) {
+        std::vector<std::string> parts;
+        std::stringstream ss(s);
+        std::string part;
+        while (std::getline(ss, part, ',')) {
+            if (!part.empty()) parts.push_back(part);
+        }
+        return parts;
+    }
+
+#ifdef SIMULATE_RIGID_BODIES
+    /* Same octagon as the Tab key in main.cpp */
+    inline void SpawnBall(Simulation::Simulation& sim, float x, float y) {
+        b2Vec2 dynamicBoxVerts[8] = { {3.3, 0}, {6.6, 0}, {10, 3.3 }, {10, 6.6}, {6.6, 10}, {3.3, 10}, {0, 6.6}, {0, 3.3} };
+        b2BodyDef bodyDef;
+        bodyDef.type = b2_dynamicBody;
+        bodyDef.position.Set(x, y);
+        b2Body* body = sim.world.CreateBody(&bodyDef);
+        b2PolygonShape dynamicBox;
+        dynamicBox.Set(dynamicBoxVerts, 8);
+        b2FixtureDef fixtureDef;
+        fixtureDef.shape = &dynamicBox;
+        fixtureDef.density = 1.0f;
+        fixtureDef.friction = 0.3f;
+        fixtureDef.restitution = 0.6;
+        fixtureDef.restitutionThreshold = 0;
+        body->CreateFixture(&fixtureDef);
+
+        sim.rigidBodies.push_back({ body });
+    }
+
+    /* Drop count balls spread evenly along the top of the world */
+    inline void SpawnBalls(Simulation::Simulation& sim, i64 count) {
+        for (i64 i = 0; i < count; i++) {
+            SpawnBall(sim, (i + 0.5f) * sim.width / count - 5, sim.height - 15);
+        }
+    }
+#endif
+
+}
@@ -5,6 +5,8 @@
 typedef uint64_t ui64;
 typedef int64_t i64;
 typedef int32_t i32;
+typedef uint32_t ui32;
+typedef uint16_t ui16;
 typedef uint8_t ui8;
 
 inline double noise() {
@@ -0,0 +1,351 @@
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <thread>
+
+/*
+    Particle benchmark: runs a set of scenarios at several grid sizes and thread counts
+    and reports tick timings and scaling efficiency as JSON.
+*/
+
+/***** SETTINGS *****/
+#define SIMULATE_RIGID_BODIES   /* Compile in the rigid body system, it is only turned on with --rigid */
+#define DOUGLAS_PEUCKER         /* Approximate world particle's Rigid body boundaries using Douglas Peucker Algorithm */
+//#define TILED_GRID              /* Store every chunk of the grid as one contiguous block */
+
+// for multithreading
+#define CHUNK_SIZE 16
+
+#define TEXTURES_DIR "../assets/textures/"
+#define MAP_WIDTH 400
+#define MAP_HEIGHT 300
+
+#include "Types.hpp"
+#include "Simulation.hpp"
+#include "Tools.hpp"
+
+using namespace Simulation;
+using namespace Tools;
+
+struct Options {
+    std::vector<std::string> scenarios;
+    std::vector<glm::ivec2> sizes = { {400, 300}, {800, 600}, {1600, 1200} };
+    std::vector<i64> threads = { 1, 2, 4, 8 };
+    i64 ticks = 200;
+    i64 warmup = 20;
+    bool rigid = false;
+    std::string texturesDir = TEXTURES_DIR;
+    std::string out;
+};
+
+struct Scenario {
+    std::string name;
+    // fills an empty simulation, returns false if the scenario couldn't be set up
+    std::function<bool(Simulation::Simulation&, const Options&)> setup;
+};
+
+struct Result {
+    std::string scenario;
+    i64 width, height, threads, ticks;
+    double ticksPerSecond, meanMs, p50Ms, p99Ms, maxMs;
+    double strongEfficiency;
+    ui64 checksum;
+};
+
+struct WeakResult {
+    std::string scenario;
+    i64 baseWidth, baseHeight, width, height, threads;
+    double meanMs;
+    double weakEfficiency;
+};
+
+/* Loads one of the shipped maps, scaled to the simulation's size with nearest neighbour sampling */
+bool SetupMap(Simulation::Simulation& sim, const Options& options, const std::string& file) {
+    std::vector<char> fc = ReadFile(options.texturesDir + file);
+    if (fc.size() != MAP_WIDTH * MAP_HEIGHT) {
+        std::cerr << "Could not load " << options.texturesDir + file << std::endl;
+        return false;
+    }
+
+    std::vector<char> scaled(sim.width * sim.height);
+    for (i64 y = 0; y < (i64)sim.height; y++) {
+        for (i64 x = 0; x < (i64)sim.width; x++) {
+            i64 mx = x * MAP_WIDTH / sim.width, my = y * MAP_HEIGHT / sim.height;
+            scaled[y * sim.width + x] = fc[my * MAP_WIDTH + mx];
+        }
+    }
+    sim.Load(scaled);
+    return true;
+}
+
+/* Fills the cells in [x0, x1) x [y0, y1), given as fractions of the grid size */
+void Fill(Simulation::Simulation& sim, double x0, double y0, double x1, double y1, ui8 t) {
+    for (i64 y = (i64)(y0 * sim.height); y < (i64)(y1 * sim.height); y++) {
+        for (i64 x = (i64)(x0 * sim.width); x < (i64)(x1 * sim.width); x++) {
+            if (t == Material::FIRE) {
+                InitializeFire(sim.grid(x, y), Material::OIL);
+            }
+            else {
+                InitializeNormal(sim.grid(x, y), t);
+            }
+            sim.WakeCell(x, y);
+        }
+    }
+}
+
+std::vector<Scenario> AllScenarios() {
+    std::vector<Scenario> scenarios;
+    for (std::string map : { "oct", "geo", "spiral", "noita", "s1" }) {
+        scenarios.push_back({ map, [map](Simulation::Simulation& sim, const Options& options) { return SetupMap(sim, options, map + ".b"); } });
+    }
+
+    // a tank of water that is constantly churning
+    scenarios.push_back({ "water_tank", [](Simulation::Simulation& sim, const Options&) {
+        Fill(sim, 0, 0, 1, 0.9, Material::WATER);
+        return true;
+    } });
+
+    // a pool of oil set alight along its surface
+    scenarios.push_back({ "burning_oil", [](Simulation::Simulation& sim, const Options&) {
+        Fill(sim, 0, 0, 1, 0.5, Material::OIL);
+        Fill(sim, 0, 0.5, 1, 0.51, Material::FIRE);
+        return true;
+    } });
+
+    // sand, wood and cotton dropped into a bath of acid
+    scenarios.push_back({ "acid_bath", [](Simulation::Simulation& sim, const Options&) {
+        Fill(sim, 0, 0, 1, 0.5, Material::ACID);
+        Fill(sim, 0.1, 0.6, 0.3, 0.8, Material::SAND);
+        Fill(sim, 0.4, 0.6, 0.6, 0.7, Material::WOOD);
+        Fill(sim, 0.7, 0.6, 0.9, 0.8, Material::COTTON);
+        return true;
+    } });
+
+    // a cliff of sand collapsing onto the floor
+    scenarios.push_back({ "sand_avalanche", [](Simulation::Simulation& sim, const Options&) {
+        Fill(sim, 0, 0.3, 0.5, 1, Material::SAND);
+        Fill(sim, 0.5, 0, 1, 0.1, Material::SAND);
+        return true;
+    } });
+
+    return scenarios;
+}
+
+/* Nearest rank percentile of sorted values */
+double Percentile(const std::vector<double>& sorted, double p) {
+    i64 rank = (i64)std::ceil(p * sorted.size());
+    return sorted[std::clamp<i64>(rank - 1, 0, sorted.size() - 1)];
+}
+
+bool Run(const Scenario& scenario, const Options& options, i64 width, i64 height, i64 threads, Result& result) {
+    Simulation::Simulation sim(scenario.name, width, height, 0, threads);
+    sim.simulateRigidBodies = options.rigid;
+    if (!scenario.setup(sim, options)) return false;
+
+    i64 tick = 0;
+    for (; tick < options.warmup; tick++) {
+        sim.Tick(tick);
+    }
+
+    std::vector<double> tickMs(options.ticks);
+    for (i64 i = 0; i < options.ticks; i++, tick++) {
+        auto start = std::chrono::steady_clock::now();
+        sim.Tick(tick);
+        auto end = std::chrono::steady_clock::now();
+        tickMs[i] = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    double totalMs = 0;
+    for (double ms : tickMs) totalMs += ms;
+    std::sort(tickMs.begin(), tickMs.end());
+
+    result.scenario = scenario.name;
+    result.width = width;
+    result.height = height;
+    result.threads = sim.pool.Size();
+    result.ticks = options.ticks;
+    result.meanMs = totalMs / options.ticks;
+    result.ticksPerSecond = 1000.0 / result.meanMs;
+    result.p50Ms = Percentile(tickMs, 0.5);
+    result.p99Ms = Percentile(tickMs, 0.99);
+    result.maxMs = tickMs.back();
+    result.strongEfficiency = 1.0;
+    result.checksum = sim.Checksum();
+    return true;
+}
+
+void PrintUsage() {
+    std::cout << "Usage: benchmark [options]" << std::endl
+        << "  --scenarios a,b,...   scenarios to run (default all): oct, geo, spiral, noita, s1, water_tank, burning_oil, acid_bath, sand_avalanche" << std::endl
+        << "  --sizes WxH,...       grid sizes (default 400x300,800x600,1600x1200), the first one is the base of the weak scaling runs" << std::endl
+        << "  --threads a,b,...     thread counts, 0 uses every core (default 1,2,4,8)" << std::endl
+        << "  --ticks N             measured ticks per run (default 200)" << std::endl
+        << "  --warmup N            unmeasured ticks before each run (default 20)" << std::endl
+        << "  --rigid               also simulate rigid bodies" << std::endl
+        << "  --textures DIR        directory of the .b maps (default " TEXTURES_DIR ")" << std::endl
+        << "  --out FILE            write the JSON report to FILE instead of stdout" << std::endl;
+}
+
+bool ParseOptions(int argc, const char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--scenarios" && hasValue) {
+            options.scenarios = Split(argv[++i]);
+            std::vector<Scenario> all = AllScenarios();
+            for (auto& name : options.scenarios) {
+                if (std::none_of(all.begin(), all.end(), [&](const Scenario& scenario) { return scenario.name == name; })) {
+                    std::cerr << "Unknown scenario " << name << std::endl;
+                    return false;
+                }
+            }
+        }
+        else if (arg == "--sizes" && hasValue) {
+            options.sizes.clear();
+            for (auto& size : Split(argv[++i])) {
+                int w, h;
+                if (sscanf(size.c_str(), "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) return false;
+                options.sizes.push_back({ w, h });
+            }
+        }
+        else if (arg == "--threads" && hasValue) {
+            options.threads.clear();
+            for (auto& value : Split(argv[++i])) {
+                i64 threads = std::atoll(value.c_str());
+                if (threads < 0) return false;
+                // 0 uses every core, resolved here so the weak scaling has a real base count
+                if (threads == 0) threads = std::max<i64>(1, std::thread::hardware_concurrency());
+                options.threads.push_back(threads);
+            }
+        }
+        else if (arg == "--ticks" && hasValue) options.ticks = std::atoll(argv[++i]);
+        else if (arg == "--warmup" && hasValue) options.warmup = std::atoll(argv[++i]);
+        else if (arg == "--rigid") options.rigid = true;
+        else if (arg == "--textures" && hasValue) options.texturesDir = argv[++i];
+        else if (arg == "--out" && hasValue) options.out = argv[++i];
+        else return false;
+    }
+    return options.ticks > 0 && options.warmup >= 0 && !options.sizes.empty() && !options.threads.empty();
+}
+
+void WriteJson(std::ostream& out, const Options& options, const std::vector<Result>& results, const std::vector<WeakResult>& weakResults) {
+    char buffer[512];
+    out << "{\n  \"ticks\": " << options.ticks << ",\n  \"warmup\": " << options.warmup
+        << ",\n  \"rigid_bodies\": " << (options.rigid ? "true" : "false")
+#ifdef TILED_GRID
+        << ",\n  \"layout\": \"tiled\""
+#else
+        << ",\n  \"layout\": \"row_major\""
+#endif
+        << ",\n  \"runs\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        snprintf(buffer, sizeof(buffer),
+            "%s\n    {\"scenario\": \"%s\", \"width\": %lld, \"height\": %lld, \"threads\": %lld, \"ticks_per_second\": %.3f, "
+            "\"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, \"strong_scaling_efficiency\": %.4f, \"checksum\": \"%016llx\"}",
+            i ? "," : "", r.scenario.c_str(), (long long)r.width, (long long)r.height, (long long)r.threads, r.ticksPerSecond,
+            r.meanMs, r.p50Ms, r.p99Ms, r.maxMs, r.strongEfficiency, (unsigned long long)r.checksum);
+        out << buffer;
+    }
+    out << "\n  ],\n  \"weak_scaling\": [";
+    for (size_t i = 0; i < weakResults.size(); i++) {
+        const WeakResult& r = weakResults[i];
+        snprintf(buffer, sizeof(buffer),
+            "%s\n    {\"scenario\": \"%s\", \"base_width\": %lld, \"base_height\": %lld, \"width\": %lld, \"height\": %lld, \"threads\": %lld, "
+            "\"mean_ms\": %.4f, \"weak_scaling_efficiency\": %.4f}",
+            i ? "," : "", r.scenario.c_str(), (long long)r.baseWidth, (long long)r.baseHeight, (long long)r.width, (long long)r.height,
+            (long long)r.threads, r.meanMs, r.weakEfficiency);
+        out << buffer;
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, const char* argv[]) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<Scenario> scenarios;
+    for (auto& scenario : AllScenarios()) {
+        if (options.scenarios.empty() || std::find(options.scenarios.begin(), options.scenarios.end(), scenario.name) != options.scenarios.end()) {
+            scenarios.push_back(scenario);
+        }
+    }
+
+    std::vector<i64> threadCounts = options.threads;
+    std::sort(threadCounts.begin(), threadCounts.end());
+    threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+    std::vector<Result> results;
+    std::vector<WeakResult> weakResults;
+    bool failed = false;
+    for (auto& scenario : scenarios) {
+        // a scenario that can't be set up fails at every size, skip the rest of its runs
+        bool loaded = true;
+
+        // strong scaling: same grid, more threads
+        for (auto& size : options.sizes) {
+            size_t first = results.size();
+            for (i64 threads : threadCounts) {
+                Result result;
+                std::cerr << "Running " << scenario.name << " " << size.x << "x" << size.y << " with " << threads << " threads" << std::endl;
+                if (!Run(scenario, options, size.x, size.y, threads, result)) {
+                    loaded = false;
+                    break;
+                }
+                results.push_back(result);
+            }
+
+            // efficiency relative to the smallest thread count
+            for (size_t i = first; i < results.size(); i++) {
+                const Result& base = results[first];
+                results[i].strongEfficiency = (base.meanMs * base.threads) / (results[i].meanMs * results[i].threads);
+            }
+            if (!loaded) break;
+        }
+        if (!loaded) {
+            failed = true;
+            continue;
+        }
+
+        // weak scaling: the grid area grows with the thread count
+        const glm::ivec2& base = options.sizes[0];
+        double baseMs = 0;
+        for (i64 threads : threadCounts) {
+            double scale = std::sqrt((double)threads / threadCounts[0]);
+            i64 width = (i64)std::round(base.x * scale), height = (i64)std::round(base.y * scale);
+
+            Result result;
+            std::cerr << "Running " << scenario.name << " " << width << "x" << height << " with " << threads << " threads (weak scaling)" << std::endl;
+            if (!Run(scenario, options, width, height, threads, result)) {
+                failed = true;
+                break;
+            }
+            if (baseMs == 0) baseMs = result.meanMs;
+
+            weakResults.push_back({ scenario.name, base.x, base.y, width, height, result.threads, result.meanMs, baseMs / result.meanMs });
+        }
+    }
+
+    if (options.out.empty()) {
+        WriteJson(std::cout, options, results, weakResults);
+    }
+    else {
+        std::ofstream out(options.out);
+        WriteJson(out, options, results, weakResults);
+    }
+
+    // the report only has the scenarios that ran, don't let it pass for a complete one
+    return failed ? 1 : 0;
+}
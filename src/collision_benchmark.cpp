@@ -0,0 +1,218 @@
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <algorithm>
+
+/*
+    Collision benchmark: drops rigid balls onto the shipped maps once per collision mesh
+    and reports the terrain fixture count, world.Step time and meshing time as JSON.
+*/
+
+/***** SETTINGS *****/
+#define SIMULATE_RIGID_BODIES   /* The rigid body system is what this measures */
+#define DOUGLAS_PEUCKER         /* Approximate world particle's Rigid body boundaries using Douglas Peucker Algorithm */
+#define PROFILING               /* The stage timers are read back for the report */
+//#define TILED_GRID              /* Store every chunk of the grid as one contiguous block */
+
+// for multithreading
+#define CHUNK_SIZE 16
+
+#define TEXTURES_DIR "../assets/textures/"
+#define MAP_WIDTH 400
+#define MAP_HEIGHT 300
+
+#include "Types.hpp"
+#include "Simulation.hpp"
+#include "Tools.hpp"
+
+using namespace Simulation;
+using namespace Tools;
+
+struct Options {
+    std::vector<std::string> maps = { "oct", "geo", "spiral", "noita", "s1" };
+    std::vector<CollisionMesh::Id> meshes = { CollisionMesh::CHAINS, CollisionMesh::TRIANGLES, CollisionMesh::CONVEX };
+    i64 balls = 40;
+    i64 ticks = 300;
+    i64 warmup = 60;
+    i64 threads = 0;
+    bool remesh = false;
+    bool windows = true;
+    std::string texturesDir = TEXTURES_DIR;
+    std::string out;
+};
+
+struct Result {
+    std::string map;
+    CollisionMesh::Id mesh;
+    i64 threads;
+    // per measured tick
+    double fixtures, proxies, cells;
+    double coverageMs, meshMs, updateMs, stepMs, tickMs;
+    ui64 checksum;
+};
+
+/* Fixtures and broadphase proxies (a chain has one per edge) of the terrain bodies, and the cells their geometry was built from */
+void CountTerrain(const Simulation::Simulation& sim, i64& fixtures, i64& proxies, i64& cells) {
+    fixtures = 0;
+    proxies = 0;
+    cells = 0;
+    for (auto& collider : sim.colliders) {
+        if (!collider.body) continue;
+        for (b2Fixture* fixture = collider.body->GetFixtureList(); fixture; fixture = fixture->GetNext()) {
+            fixtures++;
+            proxies += fixture->GetShape()->GetChildCount();
+        }
+        cells += (collider.window.maxX - collider.window.minX + 1) * (collider.window.maxY - collider.window.minY + 1);
+    }
+}
+
+bool Run(const std::string& map, CollisionMesh::Id mesh, const Options& options, Result& result) {
+    std::vector<char> fc = ReadFile(options.texturesDir + map + ".b");
+    if (fc.size() != MAP_WIDTH * MAP_HEIGHT) {
+        std::cerr << "Could not load " << options.texturesDir + map + ".b" << std::endl;
+        return false;
+    }
+
+    Simulation::Simulation sim(map, MAP_WIDTH, MAP_HEIGHT, 0, options.threads);
+    sim.collisionMesh = mesh;
+    sim.collisionWindows = options.windows;
+    sim.Load(fc);
+
+    SpawnBalls(sim, options.balls);
+
+    i64 tick = 0;
+    for (; tick < options.warmup; tick++) {
+        sim.Tick(tick);
+    }
+
+    Profiler::Profiler::Get().Clear();
+    i64 fixtures = 0, proxies = 0, cells = 0, totalFixtures = 0, totalProxies = 0, totalCells = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (i64 i = 0; i < options.ticks; i++, tick++) {
+        if (options.remesh) {
+            for (auto& collider : sim.colliders) collider.version = -1;
+        }
+
+        PROFILE_FRAME();
+        sim.Tick(tick);
+
+        CountTerrain(sim, fixtures, proxies, cells);
+        totalFixtures += fixtures;
+        totalProxies += proxies;
+        totalCells += cells;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    const Profiler::Profiler& profiler = Profiler::Profiler::Get();
+    result.map = map;
+    result.mesh = mesh;
+    result.threads = sim.pool.Size();
+    result.fixtures = (double)totalFixtures / options.ticks;
+    result.proxies = (double)totalProxies / options.ticks;
+    result.cells = (double)totalCells / options.ticks;
+    result.coverageMs = profiler.TotalMs("rigid.coverage") / options.ticks;
+    result.meshMs = profiler.TotalMs("rigid.marching_squares") / options.ticks;
+    result.updateMs = profiler.TotalMs("rigid.update_static") / options.ticks;
+    result.stepMs = profiler.TotalMs("rigid.step") / options.ticks;
+    result.tickMs = std::chrono::duration<double, std::milli>(end - start).count() / options.ticks;
+    result.checksum = sim.Checksum();
+    return true;
+}
+
+void PrintUsage() {
+    std::cout << "Usage: collision_benchmark [options]" << std::endl
+        << "  --maps a,b,...        maps to run (default oct,geo,spiral,noita,s1)" << std::endl
+        << "  --meshes a,b,...      collision meshes to compare (default chains,triangles,convex)" << std::endl
+        << "  --balls N             rigid balls dropped onto every map (default 40)" << std::endl
+        << "  --ticks N             measured ticks per run (default 300)" << std::endl
+        << "  --warmup N            unmeasured ticks before each run (default 60)" << std::endl
+        << "  --threads N           number of worker threads, 0 uses every core (default 0)" << std::endl
+        << "  --remesh              rebuild every needed chunk every tick, to time the meshing itself" << std::endl
+        << "  --full-chunks         mesh whole chunks instead of the windows the bodies can reach" << std::endl
+        << "  --textures DIR        directory of the .b maps (default " TEXTURES_DIR ")" << std::endl
+        << "  --out FILE            write the JSON report to FILE instead of stdout" << std::endl;
+}
+
+bool ParseOptions(int argc, const char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--maps" && hasValue) {
+            options.maps = Split(argv[++i]);
+        }
+        else if (arg == "--meshes" && hasValue) {
+            options.meshes.clear();
+            for (auto& name : Split(argv[++i])) {
+                auto mesh = std::find_if(std::begin(COLLISION_MESH_NAMES), std::end(COLLISION_MESH_NAMES), [&](const char* n) { return name == n; });
+                if (mesh == std::end(COLLISION_MESH_NAMES)) return false;
+                options.meshes.push_back((CollisionMesh::Id)(mesh - std::begin(COLLISION_MESH_NAMES)));
+            }
+        }
+        else if (arg == "--balls" && hasValue) options.balls = std::atoll(argv[++i]);
+        else if (arg == "--ticks" && hasValue) options.ticks = std::atoll(argv[++i]);
+        else if (arg == "--warmup" && hasValue) options.warmup = std::atoll(argv[++i]);
+        else if (arg == "--threads" && hasValue) options.threads = std::atoll(argv[++i]);
+        else if (arg == "--remesh") options.remesh = true;
+        else if (arg == "--full-chunks") options.windows = false;
+        else if (arg == "--textures" && hasValue) options.texturesDir = argv[++i];
+        else if (arg == "--out" && hasValue) options.out = argv[++i];
+        else return false;
+    }
+    return options.ticks > 0 && options.warmup >= 0 && options.balls >= 0 && options.threads >= 0 && !options.maps.empty() && !options.meshes.empty();
+}
+
+void WriteJson(std::ostream& out, const Options& options, const std::vector<Result>& results) {
+    char buffer[512];
+    out << "{\n  \"ticks\": " << options.ticks << ",\n  \"warmup\": " << options.warmup << ",\n  \"balls\": " << options.balls
+        << ",\n  \"remesh\": " << (options.remesh ? "true" : "false") << ",\n  \"windows\": " << (options.windows ? "true" : "false")
+        << ",\n  \"runs\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        snprintf(buffer, sizeof(buffer),
+            "%s\n    {\"map\": \"%s\", \"mesh\": \"%s\", \"threads\": %lld, \"fixtures\": %.1f, \"proxies\": %.1f, \"cells\": %.1f, "
+            "\"coverage_ms\": %.4f, \"mesh_ms\": %.4f, \"update_static_ms\": %.4f, \"step_ms\": %.4f, \"tick_ms\": %.4f, \"checksum\": \"%016llx\"}",
+            i ? "," : "", r.map.c_str(), COLLISION_MESH_NAMES[r.mesh], (long long)r.threads, r.fixtures, r.proxies, r.cells,
+            r.coverageMs, r.meshMs, r.updateMs, r.stepMs, r.tickMs, (unsigned long long)r.checksum);
+        out << buffer;
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, const char* argv[]) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<Result> results;
+    bool failed = false;
+    for (auto& map : options.maps) {
+        for (CollisionMesh::Id mesh : options.meshes) {
+            Result result;
+            std::cerr << "Running " << map << " with " << COLLISION_MESH_NAMES[mesh] << std::endl;
+            if (!Run(map, mesh, options, result)) {
+                failed = true;
+                break;
+            }
+            results.push_back(result);
+        }
+    }
+
+    if (options.out.empty()) {
+        WriteJson(std::cout, options, results);
+    }
+    else {
+        std::ofstream out(options.out);
+        WriteJson(out, options, results);
+    }
+
+    // the report only has the maps that loaded, don't let it pass for a complete one
+    return failed ? 1 : 0;
+}
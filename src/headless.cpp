@@ -0,0 +1,151 @@
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+
+/*
+    Headless runner: loads a .b world, runs it for a number of ticks without
+    opening a window and reports the throughput.
+*/
+
+/***** SETTINGS *****/
+#define SIMULATE_RIGID_BODIES   /* Compile in the rigid body system, it can still be turned off with --no-rigid */
+#define DOUGLAS_PEUCKER         /* Approximate world particle's Rigid body boundaries using Douglas Peucker Algorithm */
+//#define PROFILING               /* Time each stage of every tick, written to profile.csv and profile.json */
+//#define TILED_GRID              /* Store every chunk of the grid as one contiguous block */
+
+// for multithreading
+#define CHUNK_SIZE 16
+
+#include "Types.hpp"
+#include "Simulation.hpp"
+#include "Tools.hpp"
+
+struct Options {
+    std::string file;
+    std::string reactions;
+    i64 width = 400, height = 300;
+    i64 ticks = 1000;
+    i64 threads = 0;
+    ui64 seed = 0;
+    i64 balls = 0;
+    float epsilon = .5f;
+    Simulation::CollisionMesh::Id mesh = Simulation::CollisionMesh::CHAINS;
+    bool rigid = true;
+    bool checksum = false;
+};
+
+void PrintUsage() {
+    std::cout << "Usage: headless [options] [world.b]" << std::endl
+        << "  --width N     width of the simulation, must match the world file (default 400)" << std::endl
+        << "  --height N    height of the simulation, must match the world file (default 300)" << std::endl
+        << "  --ticks N     number of ticks to run, at least 1 (default 1000)" << std::endl
+        << "  --threads N   number of worker threads, 0 uses every core (default 0)" << std::endl
+        << "  --seed N      seed of the particle random numbers (default 0)" << std::endl
+        << "  --balls N     drop N rigid balls into the world, like pressing Tab (default 0)" << std::endl
+        << "  --reactions F reaction rules file (default: the built in rules)" << std::endl
+        << "  --epsilon E   Douglas Peucker tolerance of the collision outlines in cells (default 0.5)" << std::endl
+        << "  --mesh M      terrain fixtures, chains, triangles or convex (default chains)" << std::endl
+        << "  --no-rigid    only simulate particles" << std::endl
+        << "  --checksum    print the grid checksum after every tick" << std::endl;
+}
+
+bool ParseMesh(const std::string& name, Simulation::CollisionMesh::Id& mesh) {
+    for (ui8 m = 0; m < Simulation::CollisionMesh::COUNT; m++) {
+        if (name == Simulation::COLLISION_MESH_NAMES[m]) {
+            mesh = (Simulation::CollisionMesh::Id)m;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParseOptions(int argc, const char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (arg == "--width" && hasValue) options.width = std::atoll(argv[++i]);
+        else if (arg == "--height" && hasValue) options.height = std::atoll(argv[++i]);
+        else if (arg == "--ticks" && hasValue) options.ticks = std::atoll(argv[++i]);
+        else if (arg == "--threads" && hasValue) options.threads = std::atoll(argv[++i]);
+        else if (arg == "--seed" && hasValue) options.seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--balls" && hasValue) options.balls = std::atoll(argv[++i]);
+        else if (arg == "--reactions" && hasValue) options.reactions = argv[++i];
+        else if (arg == "--epsilon" && hasValue) options.epsilon = std::atof(argv[++i]);
+        else if (arg == "--mesh" && hasValue) {
+            if (!ParseMesh(argv[++i], options.mesh)) return false;
+        }
+        else if (arg == "--no-rigid") options.rigid = false;
+        else if (arg == "--checksum") options.checksum = true;
+        else if (arg.rfind("--", 0) != 0 && options.file.empty()) options.file = arg;
+        else return false;
+    }
+    return options.width > 0 && options.height > 0 && options.ticks > 0 && options.threads >= 0 && options.epsilon >= 0;
+}
+
+int main(int argc, const char* argv[]) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage();
+        return 1;
+    }
+
+    Simulation::Simulation sim("Headless", options.width, options.height, options.seed, options.threads);
+    sim.simulateRigidBodies = options.rigid;
+    sim.contourEpsilon = options.epsilon;
+    sim.collisionMesh = options.mesh;
+
+    if (!options.reactions.empty()) {
+        std::vector<char> rules = Tools::ReadFile(options.reactions);
+        if (rules.empty()) {
+            std::cerr << "Could not read " << options.reactions << std::endl;
+            return 1;
+        }
+        std::string error;
+        if (!sim.reactions.Parse(std::string(rules.begin(), rules.end()), error)) {
+            std::cerr << options.reactions << " " << error << std::endl;
+            return 1;
+        }
+    }
+
+    if (!options.file.empty()) {
+        std::vector<char> fc = Tools::ReadFile(options.file);
+        if (fc.size() != sim.width * sim.height) {
+            std::cerr << "Simulation requires binary file of size " << sim.width * sim.height << " bytes, one of " << fc.size() << " bytes was provided." << std::endl;
+            return 1;
+        }
+        sim.Load(fc);
+    }
+
+    Tools::SpawnBalls(sim, options.balls);
+
+    std::cout << "World " << (options.file.empty() ? "<empty>" : options.file) << " " << sim.width << "x" << sim.height
+        << ", " << options.ticks << " ticks, " << sim.pool.Size() << " threads, rigid bodies " << (options.rigid ? "on" : "off") << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    for (i64 tick = 0; tick < options.ticks; tick++) {
+        PROFILE_FRAME();
+        sim.Tick(tick);
+        // numbered by the ticks run so far, like PRINT_CHECKSUMS in main.cpp
+        if (options.checksum) {
+            printf("tick %lld checksum %016llx\n", (long long)tick + 1, (unsigned long long)sim.Checksum());
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    double ticksPerSecond = options.ticks / seconds;
+    printf("Total %.3f s, %.1f ticks/s, %.3f ms/tick, %.1f Mcells/s\n",
+        seconds, ticksPerSecond, 1000.0 * seconds / options.ticks, ticksPerSecond * sim.width * sim.height / 1e6);
+    printf("Checksum %016llx\n", (unsigned long long)sim.Checksum());
+
+#ifdef PROFILING
+    Profiler::Profiler::Get().WriteCsv("profile.csv");
+    Profiler::Profiler::Get().WriteChromeTrace("profile.json");
+#endif
+
+    return 0;
+}
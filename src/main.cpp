@@ -29,6 +29,9 @@
 //#define DEBUG_DRAW              /* Draw rigid body boundaries */
 //#define LOAD_FROM_FILE          /* Load binary file as initial simulation state */ 
 #define TEXTURE_FILE "oct.b"    /* Filename, stored in assets/ */
+//#define PRINT_CHECKSUMS         /* Print a checksum of the grid after every tick, to compare runs */
+//#define PROFILING               /* Time each stage of every frame, written to profile.csv and profile.json on exit */
+//#define TILED_GRID              /* Store every chunk of the grid as one contiguous block */
 
 #define SIM_WIDTH 400
 #define SIM_HEIGHT 300
@@ -48,6 +51,15 @@
 
 #define SHADER_DIR "../shader/"
 #define TEXTURES_DIR "../assets/textures/"
+#define REACTIONS_FILE "../assets/reactions.txt"
+
+namespace Rendering {
+    struct Particle {
+        GLuint id;
+        // how much of the lifetime of this particle is over?
+        GLfloat lifetime_ratio;
+    };
+};
 
 
 GLFWwindow* InitializeAndCreateWindow(std::string title, glm::ivec2 renderResolution) {
@@ -115,10 +127,10 @@ UI::UIRenderer CreateUI(const glm::ivec2 renderResolution) {
     ui.AddText(UI::Text("text"));
 
     i64 x = 10, y = 10, w = 20, h = 20;
-    for (auto t : Simulation::types) {
-        if (t == Simulation::AIR) continue;
-        std::cout << t->name << std::endl;
-        ui.AddDisplay(UI::Display(t->id, x, y, w, h, 5, t->col));
+    for (auto& t : Simulation::types) {
+        if (&t == Simulation::AIR || t.id == Simulation::Material::BORDER) continue;
+        std::cout << t.name << std::endl;
+        ui.AddDisplay(UI::Display(t.id, x, y, w, h, 5, t.col));
         x += 10 + w;
     }
     return ui;
@@ -198,6 +210,19 @@ int main(int argc, const char* argv[]) {
     // initialize simulation from file
     Simulation::Simulation sim("Powder Sim", simResolution.x, simResolution.y);
 
+    // load the reaction rules, the built in ones are used if the file is missing
+    std::vector<char> rules = readFile(REACTIONS_FILE);
+    if (rules.empty()) {
+        std::cerr << "Could not read " << REACTIONS_FILE << ", using the default reactions." << std::endl;
+    }
+    else {
+        std::string error;
+        if (!sim.reactions.Parse(std::string(rules.begin(), rules.end()), error)) {
+            std::cerr << REACTIONS_FILE << " " << error << std::endl;
+            return 1;
+        }
+    }
+
 #ifdef LOAD_FROM_FILE
     std::vector<char> fc = readFile(TEXTURES_DIR TEXTURE_FILE);
     if (fc.size() != simResolution.x * simResolution.y) {
@@ -205,19 +230,7 @@ int main(int argc, const char* argv[]) {
         return 1;
     }
     
-    for (i64 i = 0; i < sim.height; i++) {
-        for (i64 j = 0; j < sim.width; j++) {
-            char id = fc[(sim.height - i - 1) * sim.width + j];
-            const Simulation::ParticleType* t = Simulation::types[id];
-    
-            if (t == Simulation::FIRE) {
-                InitializeFire(sim.grid(j, i), Simulation::OIL);
-            }
-            else {
-                InitializeNormal(sim.grid(j, i), t);
-            }
-        }
-    }
+    sim.Load(fc);
 #endif
 
     // Initialize UI
@@ -262,6 +275,7 @@ int main(int argc, const char* argv[]) {
 
     i64 tick = 0;
     while (!glfwWindowShouldClose(window)) {
+        PROFILE_FRAME();
         double mx, my, x, y;
         glfwGetCursorPos(window, &mx, &my);
         x = mx / renderScale.x;
@@ -271,19 +285,24 @@ int main(int argc, const char* argv[]) {
         Simulation::Grid& currentGrid = sim.grid;
 
         // setup data for render
-        for (i64 i = 0; i < sim.height; i++) {
-            for (i64 j = 0; j < sim.width; j++) {
-                Simulation::Particle& p = currentGrid(j, i);
-                render_data[i * sim.width + j].id = p.t->id;
-                if (p.t == Simulation::FIRE) {
-                    render_data[i * simResolution.x + j].lifetime_ratio = std::clamp(double(p.lifetime) / p.secondary_t->burntime, 0.0, 1.0);
+        {
+            PROFILE_SCOPE("render.pack");
+            currentGrid.Export(render_data, sim.width, [](const Simulation::Particle& p) {
+                Rendering::Particle r;
+                r.id = p.t;
+                if (p.t == Simulation::Material::FIRE) {
+                    r.lifetime_ratio = std::clamp(double(p.lifetime) / Simulation::types[p.secondary_t].burntime, 0.0, 1.0);
                 }
                 else {
-                    render_data[i * simResolution.x + j].lifetime_ratio = 0;
+                    r.lifetime_ratio = 0;
                 }
-            }
+                return r;
+            });
+        }
+        {
+            PROFILE_SCOPE("render.upload");
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Rendering::Particle)* simResolution.x* simResolution.y, render_data, GL_DYNAMIC_DRAW);
         }
-        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Rendering::Particle)* simResolution.x* simResolution.y, render_data, GL_DYNAMIC_DRAW);
 
         // render to texture
         glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
@@ -375,53 +394,31 @@ int main(int argc, const char* argv[]) {
 
 #ifdef SIMULATE_RIGID_BODIES
 #ifdef DEBUG_DRAW
-        // draw contours
-        if (!sim.paused) {
-            glLineWidth(1);
-            for (auto contour : sim.contours) {
-                float sx, sy, ox, oy;
-                glBegin(GL_LINE_LOOP);
-                {
-                    int seg = 0;
-                    for (auto vertex : contour.vertices) {
-                        if (seg == 0) {
-                            glColor3f(1, 0, 0);
+        // draw the outlines of the fixtures box2d collides with
+        glLineWidth(1);
+        for (i64 c = 0; c < sim.contours.Size(); c++) {
+            float sx, sy, ox, oy;
+            glBegin(GL_LINE_LOOP);
+            {
+                const glm::vec2* vertices = sim.contours.Vertices(c);
+                for (i64 seg = 0; seg < sim.contours.Count(c); seg++) {
+                    const glm::vec2& vertex = vertices[seg];
+                    if (seg == 0) {
+                        glColor3f(1, 0, 0);
 
-                        }
-                        else if (seg == 1) {
-                            glColor3f(0, 1, 0);
-                        }
-                        else {
-                            glColor3f(0, 0, 1);
-                        }
-                        UI::SimToScreen(renderResolution, renderScale, vertex.x, vertex.y, sx, sy);
-                        UI::ScreenToOpenGL(renderResolution, sx, sy, ox, oy);
-                        glVertex2f(ox, oy);
-                        seg++;
                     }
-                }
-                glEnd();
-            }
-        }
-        else {
-            // Turn on wireframe mode
-            glPolygonMode(GL_FRONT, GL_LINE);
-            glPolygonMode(GL_BACK, GL_LINE);
-            glBegin(GL_TRIANGLES);
-            float sx, sy, ox, oy;
-            for (auto triangle : sim.triangles) {
-                for (int i = 0; i < 3; i++) {
-                    TPPLPoint& p = triangle.GetPoint(i);
-                    UI::SimToScreen(renderResolution, renderScale, p.x, p.y, sx, sy);
+                    else if (seg == 1) {
+                        glColor3f(0, 1, 0);
+                    }
+                    else {
+                        glColor3f(0, 0, 1);
+                    }
+                    UI::SimToScreen(renderResolution, renderScale, vertex.x, vertex.y, sx, sy);
                     UI::ScreenToOpenGL(renderResolution, sx, sy, ox, oy);
                     glVertex2f(ox, oy);
                 }
             }
             glEnd();
-            // Turn off wireframe mode
-            glPolygonMode(GL_FRONT, GL_FILL);
-            glPolygonMode(GL_BACK, GL_FILL);
-
         }
 #endif
 #endif
@@ -458,10 +455,11 @@ int main(int argc, const char* argv[]) {
                     float noiseThresh =  (t == Simulation::WOOD || t == Simulation::AIR || t == Simulation::COTTON || t == Simulation::FUSE) ? 0 : 0.99;
                     if (currentGrid.InBounds(px, py) && noise() > noiseThresh) {
                         if (t == Simulation::FIRE) {
-                            InitializeFire(currentGrid(px, py), Simulation::OIL);
+                            InitializeFire(currentGrid(px, py), Simulation::Material::OIL);
                         } else {
-                            InitializeNormal(currentGrid(px, py), t);
+                            InitializeNormal(currentGrid(px, py), t->id);
                         }
+                        sim.WakeCell(px, py);
                     }
                 }
             }
@@ -494,12 +492,15 @@ int main(int argc, const char* argv[]) {
 
         if (sim.paused) {
             //if (currentGrid.InBounds(x, y)) {
-            //    std::cout << currentGrid(x, y).t->id << std::endl;
+            //    std::cout << (int)currentGrid(x, y).t << std::endl;
             //}
         }
         else {
             sim.Tick(tick);
             tick++;
+#ifdef PRINT_CHECKSUMS
+            printf("tick %lld checksum %016llx\n", (long long)tick, (unsigned long long)sim.Checksum());
+#endif
         }
         //std::cout << "Tick" << std::endl;
     }
@@ -507,5 +508,10 @@ int main(int argc, const char* argv[]) {
     baseShader.unuse();
     glfwDestroyWindow(window);
 
+#ifdef PROFILING
+    Profiler::Profiler::Get().WriteCsv("profile.csv");
+    Profiler::Profiler::Get().WriteChromeTrace("profile.json");
+#endif
+
 
 }